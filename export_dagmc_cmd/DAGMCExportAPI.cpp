@@ -0,0 +1,70 @@
+#include "DAGMCExportAPI.hpp"
+#include "ExportSession.hpp"
+#include "H5Compression.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace {
+
+//! The reason the last write failed
+std::string last_error;
+
+}
+
+moab::Interface* dagmc_exported_model(moab::EntityHandle& file_set)
+{
+  ExportSession& session = ExportSession::shared();
+  file_set = session.handed_off_set();
+  return file_set ? session.mdb() : 0;
+}
+
+void* dagmc_export_interface()
+{
+  moab::EntityHandle file_set;
+  return dagmc_exported_model(file_set);
+}
+
+moab::EntityHandle dagmc_export_file_set()
+{
+  return ExportSession::shared().handed_off_set();
+}
+
+int dagmc_export_write(const char* filename, const char* options)
+{
+  ExportSession& session = ExportSession::shared();
+  last_error.clear();
+  if (!session.handed_off_set()) {
+    last_error = "no model was left in memory by an export";
+    return moab::MB_ENTITY_NOT_FOUND;
+  }
+
+  std::string name = filename ? filename : session.handoff_filename();
+  std::string write_options = options ? options : session.handoff_write_options();
+  moab::ErrorCode rval = session.mdb()->write_file(name.c_str(), 0, write_options.c_str());
+  if (moab::MB_SUCCESS != rval) {
+    std::string moab_error;
+    session.mdb()->get_last_error(moab_error);
+    last_error = "could not write " + name + ": " + moab_error;
+    return rval;
+  }
+
+  if (session.handoff_compress_level() > 0) {
+    std::ostringstream errors;
+    if (!compress_h5_file(name, session.handoff_compress_level(), errors)) {
+      last_error = "could not compress " + name + ": " + errors.str();
+      return moab::MB_FAILURE;
+    }
+  }
+  return moab::MB_SUCCESS;
+}
+
+const char* dagmc_export_error()
+{
+  return last_error.c_str();
+}
+
+void dagmc_export_release()
+{
+  ExportSession::shared().reset();
+}
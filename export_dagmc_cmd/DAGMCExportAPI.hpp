@@ -0,0 +1,54 @@
+#ifndef DAGMCEXPORTAPI_HPP
+#define DAGMCEXPORTAPI_HPP
+
+#include "moab/Interface.hpp"
+
+#ifdef _WIN32
+#define DAGMC_EXPORT_API __declspec(dllexport)
+#else
+#define DAGMC_EXPORT_API __attribute__((visibility("default")))
+#endif
+
+/*!
+ * Access to the model left in memory by 'export dagmc ... in_memory', for
+ * SDK programs and Cubit's Python in the same process. The model is the
+ * whole faceted DAGMC model in the plugin's MOAB instance, with its file set
+ * and tags, as it would have been written. It stays valid until the next
+ * export or dagmc_export_release().
+ *
+ * A DAGMC instance can be built on it without reading a file:
+ *   moab::EntityHandle file_set;
+ *   moab::DagMC dag(dagmc_exported_model(file_set));
+ *   dag.load_existing_contents();
+ */
+
+//! The instance holding the handed-off model and its file set, or 0 if
+//! there is none
+DAGMC_EXPORT_API moab::Interface* dagmc_exported_model(moab::EntityHandle& file_set);
+
+extern "C" {
+
+//! The moab::Interface* of the handed-off model, or null if there is none
+DAGMC_EXPORT_API void* dagmc_export_interface();
+
+//! The file set of the handed-off model, or 0 if there is none
+DAGMC_EXPORT_API moab::EntityHandle dagmc_export_file_set();
+
+//! Write the handed-off model, to the file and with the writer options of
+//! the export command if filename or options is null, and compress it as
+//! the command's compress option asked. A failed compression leaves the
+//! uncompressed file and returns moab::MB_FAILURE. Returns a
+//! moab::ErrorCode; dagmc_export_error() tells why it failed.
+DAGMC_EXPORT_API int dagmc_export_write(const char* filename, const char* options);
+
+//! The reason the last dagmc_export_write failed, or an empty string if it
+//! succeeded. Valid until the next call of dagmc_export_write.
+DAGMC_EXPORT_API const char* dagmc_export_error();
+
+//! Empty the instance, including the tags of the export; the next export
+//! does so as well
+DAGMC_EXPORT_API void dagmc_export_release();
+
+}
+
+#endif // DAGMCEXPORTAPI_HPP
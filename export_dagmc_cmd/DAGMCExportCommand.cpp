@@ -1,4 +1,9 @@
 #include "DAGMCExportCommand.hpp"
+#include "H5Compression.hpp"
+#include "FacetDecimator.hpp"
+#include "Histogram.hpp"
+#include "MortonOrder.hpp"
+#include "PointGrid.hpp"
 #include "CubitInterface.hpp"
 
 // CGM includes
@@ -13,6 +18,7 @@
 #include "Curve.hpp"
 
 #include "RefGroup.hpp"
+#include "RefVolume.hpp"
 #include "RefFace.hpp"
 #include "RefEdge.hpp"
 #include "RefVertex.hpp"
@@ -24,10 +30,19 @@
 #include "moab/Core.hpp"
 #include "moab/Interface.hpp"
 #include "moab/GeomTopoTool.hpp"
+#include "moab/ReadUtilIface.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <thread>
 
 #define CHK_MB_ERR_RET(A,B)  if (moab::MB_SUCCESS != (B)) { \
   message << (A) << (B) << std::endl;                                   \
-  CubitInterface::get_cubit_message_handler()->print_message(message.str().c_str()); \
+  abort_export();                                                       \
   return false;                                                         \
   }
 
@@ -36,8 +51,132 @@
   return rval;                                                         \
   }
 
+namespace {
+
+// Seconds elapsed since start
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Whether every facet in a GMem style facet list is complete and only refers
+// to points below num_points
+bool valid_facet_list(const std::vector<int>& facet_list, size_t num_points)
+{
+  for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+    if (facet_list[i] < 0 || i + facet_list[i] >= facet_list.size())
+      return false;
+    for (int j = 1; j <= facet_list[i]; ++j) {
+      if (facet_list[i + j] < 0 || facet_list[i + j] >= (int)num_points)
+        return false;
+    }
+  }
+  return true;
+}
+
+// Call work(i) for every i in [0, count), spreading the calls over up to
+// num_threads threads. Indices are handed out one at a time so that a single
+// expensive item does not hold up a whole block of cheap ones. No further
+// calls are started once stop() returns true, so some items may be left
+// undone.
+template <class Work, class Stop>
+void parallel_for(size_t count, int num_threads, Work work, Stop stop)
+{
+  if (num_threads < 2 || count < 2) {
+    for (size_t i = 0; i < count && !stop(); ++i)
+      work(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count && !stop(); i = next++)
+      work(i);
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < std::min((size_t)num_threads, count); ++t)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (size_t t = 0; t < pool.size(); ++t)
+    pool[t].join();
+}
+
+template <class Work>
+void parallel_for(size_t count, int num_threads, Work work)
+{
+  parallel_for(count, num_threads, work, []() { return false; });
+}
+
+// A surface vertex and the coincident curve vertex replacing it
+struct VertexMerge
+{
+  moab::EntityHandle surface;
+  moab::EntityHandle removed;
+  moab::EntityHandle kept;
+};
+
+// A curve and the vertices it shares with its surfaces, for sealing
+struct SealCurve
+{
+  moab::EntityHandle set;
+  int id;
+  std::vector<moab::EntityHandle> verts;
+  std::vector<CubitVector> points;
+  //! Indices of the surfaces bounded by the curve
+  std::vector<size_t> surfaces;
+  std::vector<VertexMerge> merges;
+  double seconds;
+};
+
+// The triangles of a surface and the vertices on their boundary that are
+// not yet shared with a curve, for sealing
+struct SealSurface
+{
+  moab::EntityHandle set;
+  std::vector<moab::EntityHandle> conn;
+  std::vector<moab::EntityHandle> skin;
+  std::vector<CubitVector> skin_points;
+  //! Curve vertices on the boundary, sorted once sealing is done
+  std::vector<moab::EntityHandle> curve_skin;
+  bool has_other_facets;
+};
+
+// Split filename into the part before its extension and the extension
+void split_extension(const std::string& filename, std::string& stem, std::string& ext)
+{
+  size_t dot = filename.find_last_of('.');
+  size_t slash = filename.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = filename.size();
+  stem = filename.substr(0, dot);
+  ext = filename.substr(dot);
+}
+
+// Name of the file holding part k of an export to filename, e.g.
+// model_batch3.h5m for batch 3 of model.h5m
+std::string part_file_name(const std::string& filename, const char* kind, int k)
+{
+  std::string stem, ext;
+  split_extension(filename, stem, ext);
+  std::ostringstream name;
+  name << stem << "_" << kind << k << ext;
+  return name.str();
+}
+
+// Name of the index listing the part files of an export to filename, e.g.
+// model.batches for model.h5m
+std::string index_file_name(const std::string& filename, const char* suffix)
+{
+  std::string stem, ext;
+  split_extension(filename, stem, ext);
+  return stem + suffix;
+}
+
+}
+
 DAGMCExportCommand::DAGMCExportCommand() :
-  geom_tag(0), id_tag(0), name_tag(0), category_tag(0), faceting_tol_tag(0), geometry_resabs_tag(0)
+  readUtil(0), geom_tag(0), id_tag(0), name_tag(0), category_tag(0), faceting_tol_tag(0), geometry_resabs_tag(0)
 {
   // set default values
   norm_tol = 5;
@@ -45,6 +184,39 @@ DAGMCExportCommand::DAGMCExportCommand() :
   len_tol = 0.0;
   verbose_warnings = false;
   fatal_on_curves = false;
+  num_threads = 1;
+  share_vertices = false;
+  report_timing = false;
+  incremental = false;
+  tight_memory = false;
+  keep_mesh = false;
+  batch_size = 0;
+  num_shards = 1;
+  compact = false;
+  compress_level = 0;
+  element_ids = false;
+  build_obb = false;
+  stats = false;
+  dry_run = false;
+  in_memory = false;
+  output_set = 0;
+  decimate = false;
+  decimation_angle = 1.0;
+  decimation_distance = GEOMETRY_RESABS;
+  reorder = false;
+  profile_count = 0;
+  profile_tags = false;
+  auto_tolerance = 0.0;
+  surface_faceting_tol_tag = surface_normal_tol_tag = 0;
+  facet_time_tag = facet_points_tag = facet_count_tag = 0;
+  cached_faceting_tol = faceting_tol;
+  cached_norm_tol = norm_tol;
+  cached_len_tol = len_tol;
+  progress_interval = 10.0;
+  // Rough sizes for the first census, before any export has been measured
+  points_per_curve = 8;
+  points_per_surface = 50;
+  facets_per_surface = 80;
 
   CubitMessageHandler *console = CubitInterface::get_cubit_message_handler();
   if (console) {
@@ -65,11 +237,25 @@ std::vector<std::string> DAGMCExportCommand::get_syntax()
   // found in the documentation.
   std::string syntax =
       "export dagmc "
-      "<string:label='filename',help='<filename>'> "
-      "[faceting_tolerance <value:label='faceting_tolerance',help='<faceting tolerance>'>] "
+      "<string:label='filename',help='<filename>'>... "
+      "[faceting_tolerance <value:label='faceting_tolerance',help='<faceting tolerance>'>...] "
       "[length_tolerance <value:label='length_tolerance',help='<length tolerance>'>] "
       "[normal_tolerance <value:label='normal_tolerance',help='<normal tolerance>'>] "
-      "[make_watertight]"
+      "[make_watertight] [share_vertices]"
+      "[threads <value:label='threads',help='<number of faceting threads>'>] "
+      "[batch_size <value:label='batch_size',help='<volumes per output file>'>] "
+      "[shards <value:label='shards',help='<number of output files>'>] "
+      "[write_options <string:label='write_options',help='<MOAB writer options>'>] "
+      "[compact] [compress <value:label='compress',help='<deflate level 1-9>'>] [element_ids] [build_obb] "
+      "[decimate] [decimation_angle <value:label='decimation_angle',help='<degrees>'>] "
+      "[decimation_distance <value:label='decimation_distance',help='<distance>'>] [reorder] "
+      "[volume <value:label='volume',help='<volume ids>'>...] "
+      "[group <string:label='group',help='<group names>'>...] "
+      "[profile_entities [<value:label='profile_entities',help='<number of entities to list>'>]] "
+      "[profile_tags] [auto_tolerance <value:label='auto_tolerance',help='<fraction of surface size>'>] "
+      "[incremental] [keep_mesh] [tight_memory] [facet_cache <string:label='facet_cache',help='<cache directory>'>] "
+      "[stats] [dry_run] [in_memory] [timing] [timing_file <string:label='timing_file',help='<json timing file>'>] "
+      "[progress <value:label='progress',help='<seconds between progress reports>'>] "
       "[verbose] [fatal_on_curves]";
 
   std::vector<std::string> syntax_list;
@@ -87,74 +273,133 @@ std::vector<std::string> DAGMCExportCommand::get_syntax_help()
 std::vector<std::string> DAGMCExportCommand::get_help()
 {
   std::vector<std::string> help;
+  help.push_back("make_watertight: with threads greater than 1, or with share_vertices, "
+                 "surface boundary vertices are first sealed to the curve vertices, and "
+                 "make_watertight is skipped if nothing is left unsealed");
   return help;
 }
 
 bool DAGMCExportCommand::execute(CubitCommandData &data)
 {
 
-  static moab::Core instance;
-  mdbImpl = &instance;
-  mw = new MakeWatertight(mdbImpl);
-  myGeomTool = new moab::GeomTopoTool(mdbImpl);
+  session = &ExportSession::shared();
+  session->begin_export();
+  mdbImpl = session->mdb();
   message.str("");
 
   bool result = true;
   moab::ErrorCode rval;
 
+  // Vertices and facets are allocated in blocks through the read utility
+  rval = mdbImpl->query_interface(readUtil);
+  CHK_MB_ERR_RET("Error getting MOAB read utility: ",rval);
+
+  // Only the selected volumes and their closure are exported, if any
+  rval = select_entities(data);
+  CHK_MB_ERR_RET("Error selecting volumes: ",rval);
+
+  // All options are settled first, since some of them override others
+  rval = parse_options(data);
+  CHK_MB_ERR_RET("Error parsing options: ",rval);
+
+  // Start from an empty instance unless the topology sets kept by the
+  // previous export can be used again
+  const bool reuse_topology = keep_mesh && session->kept_model() && kept_model_matches();
+  if (!reuse_topology) {
+    rval = reset_instance();
+    CHK_MB_ERR_RET("Error resetting MOAB instance: ",rval);
+  }
+  myGeomTool = session->geom_tool();
+  mw = session->watertight();
+
   // Create entity sets for all geometric entities
   refentity_handle_map entmap[5];
 
+  // Every phase is timed; the results are only reported with 'timing'
+  timer.reset(mdbImpl);
+
+  timer.start("create_tags");
   rval = create_tags();
   CHK_MB_ERR_RET("Error initializing DAGMC export: ",rval);
 
-  // create a file set for storage of tolerance values
-  moab::EntityHandle file_set;
-  rval = mdbImpl->create_meshset(0, file_set);
-  CHK_MB_ERR_RET("Error creating file set.",rval);
-  
-  rval = parse_options(data, &file_set);
-  CHK_MB_ERR_RET("Error parsing options: ",rval);
-
-  rval = create_entity_sets(entmap);
-  CHK_MB_ERR_RET("Error creating entity sets: ",rval);
+  // One file is written for each faceting tolerance; a single filename is
+  // numbered for each
+  std::vector<std::string> filenames;
+  data.get_strings("filename", filenames);
+  if (filenames.size() == 1 && faceting_tols.size() > 1) {
+    for (size_t k = 1; k <= faceting_tols.size(); ++k)
+      filenames.push_back(part_file_name(filenames[0], "tol", k));
+    filenames.erase(filenames.begin());
+  }
+  if (filenames.size() != faceting_tols.size()) {
+    message << "Error: " << filenames.size() << " filenames given for "
+            << faceting_tols.size() << " faceting tolerances" << std::endl;
+    abort_export();
+    return false;
+  }
 
-  rval = create_topology(entmap);
-  CHK_MB_ERR_RET("Error creating topology: ",rval);
-  
-  rval = store_surface_senses(entmap[2], entmap[3]);
-  CHK_MB_ERR_RET("Error storing surface senses: ",rval);
-  
-  rval = store_curve_senses(entmap[1], entmap[2]);
-  CHK_MB_ERR_RET("Error storing curve senses: ",rval);
+  // The sets, topology, senses and groups do not depend on the tolerance
+  // and are made once for all of them
+  if (reuse_topology) {
+    message << "Reusing the topology sets of the previous export" << std::endl;
+    const ExportSession::KeptModel* kept = session->kept_model();
+    for (int dim = 0; dim < 4; ++dim)
+      entmap[dim] = kept->sets[dim];
+  }
+  else {
+    timer.start("create_entity_sets");
+    rval = create_entity_sets(entmap);
+    CHK_MB_ERR_RET("Error creating entity sets: ",rval);
+
+    timer.start("create_topology");
+    rval = create_topology(entmap);
+    CHK_MB_ERR_RET("Error creating topology: ",rval);
+
+    timer.start("store_surface_senses");
+    rval = store_surface_senses(entmap[2], entmap[3]);
+    CHK_MB_ERR_RET("Error storing surface senses: ",rval);
+
+    timer.start("store_curve_senses");
+    rval = store_curve_senses(entmap[1], entmap[2]);
+    CHK_MB_ERR_RET("Error storing curve senses: ",rval);
+  }
     
+  timer.start("store_groups");
   rval = store_groups(entmap);
   CHK_MB_ERR_RET("Error storing groups: ",rval);
-  
-  entmap[3].clear();
-  entmap[4].clear();
-  
-  rval = create_vertices(entmap[0]);
-  CHK_MB_ERR_RET("Error creating vertices: ",rval);
-  
-  rval = create_curve_facets(entmap[1], entmap[0]);
-  CHK_MB_ERR_RET("Error faceting curves: ",rval);
 
-  rval = create_surface_facets(entmap[2], entmap[0]);
-  CHK_MB_ERR_RET("Error faceting surfaces: ",rval);
+  // Volumes and groups are only needed again to split the output into
+  // batches or shards, for another tolerance, or volumes to keep the
+  // topology sets or for the statistics
+  if (0 == batch_size && num_shards < 2 && 1 == faceting_tols.size()) {
+    if (!keep_mesh && !stats)
+      entmap[3].clear();
+    entmap[4].clear();
+  }
+
+  for (size_t k = 0; k < faceting_tols.size(); ++k) {
+    if (k > 0) {
+      // Only the topology sets and groups are kept for the next tolerance
+      timer.start("clear_mesh");
+      rval = clear_mesh(entmap, true);
+      CHK_MB_ERR_RET("Error deleting the mesh of the previous tolerance: ",rval);
+    }
 
-  rval = gather_ents(file_set);
-  CHK_MB_ERR_RET("Could not gather entities into file set.", rval);
+    // Only the model of the last tolerance can stay in memory
+    const bool write = !in_memory || k + 1 < faceting_tols.size();
+    rval = export_tolerance(entmap, faceting_tols[k], filenames[k], write);
+    CHK_MB_ERR_RET("Error exporting model: ",rval);
+    print_summary();
+  }
 
-  if (make_watertight) {
-    rval = mw->make_mesh_watertight(file_set, faceting_tol, false);
-    CHK_MB_ERR_RET("Could not make the model watertight.", rval);
+  if (keep_mesh) {
+    timer.start("keep_topology");
+    rval = keep_topology(entmap);
+    CHK_MB_ERR_RET("Error keeping topology sets: ",rval);
   }
-  
-  std::string filename;
-  data.get_string("filename",filename);
-  rval = mdbImpl->write_file(filename.c_str());
-  CHK_MB_ERR_RET("Error writing file: ",rval);
+  if (in_memory)
+    session->hand_off(output_set, filenames.back(), write_options, compress_level);
+  timer.stop();
 
   rval = teardown();
   CHK_MB_ERR_RET("Error tearing down export command.",rval);
@@ -162,40 +407,326 @@ bool DAGMCExportCommand::execute(CubitCommandData &data)
   return result;
 }
 
-moab::ErrorCode DAGMCExportCommand::parse_options(CubitCommandData &data, moab::EntityHandle* file_set)
+moab::ErrorCode DAGMCExportCommand::export_tolerance(refentity_handle_map (&entmap)[5],
+                                                     double tolerance,
+                                                     const std::string& filename,
+                                                     bool write)
 {
   moab::ErrorCode rval;
 
-  // read parsed command for faceting tolerance
-  data.get_value("faceting_tolerance",faceting_tol);
-  message << "Setting faceting tolerance to " << faceting_tol << std::endl;
+  faceting_tol = tolerance;
+  if (faceting_tols.size() > 1)
+    message << "Exporting " << filename << " with faceting tolerance "
+            << faceting_tol << std::endl;
 
-  // read parsed command for length tolerance
-  data.get_value("length_tolerance",len_tol);
-  message << "Setting length tolerance to " << len_tol << std::endl;
+  // create a file set for storage of tolerance values
+  moab::EntityHandle file_set;
+  rval = mdbImpl->create_meshset(0, file_set);
+  CHK_MB_ERR_RET_MB("Error creating file set.",rval);
+  output_set = file_set;
 
   // Always tag with the faceting_tol and geometry absolute resolution
-  // If file_set is defined, use that, otherwise (file_set == NULL) tag the interface  
-  moab::EntityHandle set = file_set ? *file_set : 0;
-  rval = mdbImpl->tag_set_data(faceting_tol_tag, &set, 1, &faceting_tol);
+  rval = mdbImpl->tag_set_data(faceting_tol_tag, &file_set, 1, &faceting_tol);
   CHK_MB_ERR_RET_MB("Error setting faceting tolerance tag",rval);
+  rval = mdbImpl->tag_set_data(geometry_resabs_tag, &file_set, 1, &GEOMETRY_RESABS);
+  CHK_MB_ERR_RET_MB("Error setting geometry_resabs_tag",rval);
+
+  // Previous tessellations are only valid for the tolerances they were
+  // made with
+  if (!incremental || faceting_tol != cached_faceting_tol ||
+      norm_tol != cached_norm_tol || len_tol != cached_len_tol) {
+    curve_cache.clear();
+    surface_cache.clear();
+  }
+  cached_faceting_tol = faceting_tol;
+  cached_norm_tol = norm_tol;
+  cached_len_tol = len_tol;
+  if (!facet_cache.open(facet_cache_dir, faceting_tol, norm_tol, len_tol))
+    message << "Warning: could not create facet cache directory " << facet_cache_dir << std::endl;
+  facet_cache.reset_statistics();
+
+  timer.start("create_vertices");
+  rval = create_vertices(entmap[0], vertex_handles);
+  CHK_MB_ERR_RET_MB("Error creating vertices: ",rval);
+
+  timer.start("resolve_tolerances");
+  rval = resolve_tolerances(entmap[1], entmap[2]);
+  CHK_MB_ERR_RET_MB("Error resolving faceting tolerances: ",rval);
+
+  timer.start("census");
+  take_census(entmap[1], entmap[2]);
+
+  start_faceting();
+
+  if (batch_size > 0) {
+    // The volumes are faceted and written a batch at a time
+    rval = export_batches(entmap, filename);
+    CHK_MB_ERR_RET_MB("Error exporting volume batches: ",rval);
+    finish_faceting(entmap[1].size(), entmap[2].size());
+    return moab::MB_SUCCESS;
+  }
+
+  timer.start("create_curve_facets");
+  rval = create_curve_facets(entmap[1], vertex_handles);
+  CHK_MB_ERR_RET_MB("Error faceting curves: ",rval);
+
+  timer.start("create_surface_facets");
+  rval = create_surface_facets(entmap[2], vertex_handles);
+  CHK_MB_ERR_RET_MB("Error faceting surfaces: ",rval);
+  finish_faceting(entmap[1].size(), entmap[2].size());
+
+  if (stats) {
+    timer.start("statistics");
+    rval = report_statistics(entmap);
+    CHK_MB_ERR_RET_MB("Error collecting statistics: ",rval);
+  }
+  if (dry_run) {
+    message << "Dry run, " << filename << " was not written" << std::endl;
+    return moab::MB_SUCCESS;
+  }
+
+  // With share_vertices the surface boundary points that are curve or
+  // geometric vertices are already sealed, but the curve vertices are only
+  // known to be on the surface boundaries once seal_curves has checked them
+  bool sealed = false;
+  if (make_watertight && (share_vertices || num_threads > 1)) {
+    timer.start("seal_curves");
+    size_t unsealed;
+    rval = seal_curves(entmap[1], entmap[2], unsealed);
+    CHK_MB_ERR_RET_MB("Error sealing surfaces to curves: ",rval);
+    sealed = 0 == unsealed;
+  }
+
+  timer.start("gather_ents");
+  rval = gather_ents(file_set);
+  CHK_MB_ERR_RET_MB("Could not gather entities into file set.", rval);
+
+  if (make_watertight) {
+    timer.start("make_watertight");
+    if (sealed && 0 == failed_curve_count) {
+      // Every surface boundary point is a curve or geometric vertex and every
+      // curve vertex is on the boundary of its surfaces, so the model is
+      // already watertight
+      message << "Surfaces share all curve vertices, skipping make_watertight" << std::endl;
+    } else {
+      // make_watertight cannot report progress itself, so only its duration
+      // is shown, and like the other phases only if it took longer than the
+      // progress interval
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      rval = mw->make_mesh_watertight(file_set, faceting_tol, false);
+      CHK_MB_ERR_RET_MB("Could not make the model watertight.", rval);
+      const double seconds = seconds_since(start);
+      if (progress_interval > 0 && seconds >= progress_interval)
+        message << "make_watertight took " << seconds << " s" << std::endl;
+    }
+  }
+  
+  if (build_obb) {
+    timer.start("build_obb");
+    rval = myGeomTool->find_geomsets();
+    CHK_MB_ERR_RET_MB("Error finding geometry sets: ",rval);
+    rval = myGeomTool->construct_obb_trees();
+    CHK_MB_ERR_RET_MB("Error building OBB trees: ",rval);
+  }
+
+  if (element_ids) {
+    timer.start("assign_element_ids");
+    rval = assign_element_ids();
+    CHK_MB_ERR_RET_MB("Error assigning element ids: ",rval);
+  }
+
+  if (!write) {
+    message << "Keeping the model in memory instead of writing " << filename << std::endl;
+    return moab::MB_SUCCESS;
+  }
+
+  timer.start("write_file");
+  if (num_shards > 1)
+    rval = write_shards(entmap, filename);
+  else
+    rval = mdbImpl->write_file(filename.c_str(), 0, write_options.c_str());
+  CHK_MB_ERR_RET_MB("Error writing file: ",rval);
+  if (num_shards < 2 && compress_level > 0) {
+    timer.start("compress");
+    compress_output(filename);
+  }
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::parse_options(CubitCommandData &data)
+{
+  // read parsed command for faceting tolerances, one for each output file
+  faceting_tols.clear();
+  data.get_values("faceting_tolerance", faceting_tols);
+  if (faceting_tols.empty())
+    faceting_tols.push_back(faceting_tol);
+  faceting_tol = faceting_tols[0];
+  message << "Setting faceting tolerance to";
+  for (size_t k = 0; k < faceting_tols.size(); ++k)
+    message << " " << faceting_tols[k];
+  message << std::endl;
+
+  // read parsed command for length tolerance
+  data.get_value("length_tolerance",len_tol);
+  message << "Setting length tolerance to " << len_tol << std::endl;
 
   // read parsed command for normal tolerance
   data.get_value("normal_tolerance",norm_tol);
   message << "Setting normal tolerance to " << norm_tol << std::endl;
-
-  rval = mdbImpl->tag_set_data(geometry_resabs_tag, &set, 1, &GEOMETRY_RESABS);
-  CHK_MB_ERR_RET_MB("Error setting geometry_resabs_tag",rval);
   
+  // read parsed command for the number of faceting threads
+  num_threads = 1;
+  data.get_value("threads", num_threads);
+  if (num_threads < 1)
+    num_threads = 1;
+  message << "Using " << num_threads << " faceting thread(s)" << std::endl;
+
+  // read parsed command for incremental export; the previous tessellations
+  // are checked against the tolerances for each output file
+  incremental = data.find_keyword("incremental");
+
+  // read parsed command for the tight memory mode, which keeps no
+  // tessellations for later exports
+  tight_memory = data.find_keyword("tight_memory");
+  if (tight_memory && incremental) {
+    message << "Warning: incremental is ignored with tight_memory" << std::endl;
+    incremental = false;
+  }
+
+  // read parsed command for the on-disk facet cache, opened with the
+  // tolerances of each output file
+  facet_cache_dir.clear();
+  data.get_string("facet_cache", facet_cache_dir);
+
+  // read parsed command for progress reports during faceting
+  progress_interval = 10.0;
+  data.get_value("progress", progress_interval);
+  progress.set_interval(progress_interval);
+
+  // read parsed command for timing output
+  timing_file.clear();
+  data.get_string("timing_file", timing_file);
+  report_timing = data.find_keyword("timing") || !timing_file.empty();
+
   // read parsed command for verbosity
   verbose_warnings = data.find_keyword("verbose");
   fatal_on_curves = data.find_keyword("fatal_on_curves");
   make_watertight = data.find_keyword("make_watertight");
+  share_vertices = data.find_keyword("share_vertices");
+
+  // read parsed command for the number of volumes written per batch file
+  batch_size = 0;
+  data.get_value("batch_size", batch_size);
+  if (batch_size < 0)
+    batch_size = 0;
+  if (batch_size > 0) {
+    message << "Writing " << batch_size << " volume(s) per batch file" << std::endl;
+    if (make_watertight) {
+      message << "Warning: make_watertight needs the whole model and is ignored "
+              << "when writing batches" << std::endl;
+      make_watertight = false;
+    }
+  }
+
+  // read parsed command for the number of shards the model is split into
+  num_shards = 1;
+  data.get_value("shards", num_shards);
+  if (num_shards > 1 && batch_size > 0) {
+    message << "Warning: shards is ignored when writing batches" << std::endl;
+    num_shards = 1;
+  }
+  // read parsed command for the statistics, which need the whole model
+  // faceted at once
+  dry_run = data.find_keyword("dry_run");
+  stats = dry_run || data.find_keyword("stats");
+  if (dry_run && (batch_size > 0 || num_shards > 1)) {
+    message << "Warning: batch_size and shards are ignored with dry_run" << std::endl;
+    batch_size = 0;
+    num_shards = 1;
+  }
+  if (stats && batch_size > 0) {
+    message << "Warning: stats is ignored when writing batches" << std::endl;
+    stats = false;
+  }
+
+  // read parsed command for leaving the model in memory for the in-memory
+  // API; it replaces the kept topology sets
+  keep_mesh = data.find_keyword("keep_mesh");
+  in_memory = data.find_keyword("in_memory");
+  if (in_memory && (batch_size > 0 || dry_run)) {
+    message << "Warning: in_memory is ignored with batch_size and dry_run" << std::endl;
+    in_memory = false;
+  }
+  if (in_memory && num_shards > 1) {
+    message << "Warning: shards is ignored with in_memory" << std::endl;
+    num_shards = 1;
+  }
+  if (in_memory && keep_mesh) {
+    message << "Warning: keep_mesh is ignored with in_memory" << std::endl;
+    keep_mesh = false;
+  }
+  if (num_shards > 1)
+    message << "Splitting the model into " << num_shards << " shards" << std::endl;
+
+  // read parsed command for options passed through to the MOAB writer
+  write_options.clear();
+  data.get_string("write_options", write_options);
+
+  // read parsed command for output size reduction; make_watertight works on
+  // the curve edges, so they are kept when it is used
+  compact = data.find_keyword("compact");
+  if (compact && make_watertight)
+    message << "Warning: curve edges are kept for make_watertight" << std::endl;
+  compress_level = 0;
+  data.get_value("compress", compress_level);
+  compress_level = std::min(compress_level, 9);
+  if (compress_level > 0)
+    message << "Compressing output with deflate level " << compress_level << std::endl;
+  if (compress_level > 0 && in_memory)
+    message << "Warning: the model kept in memory is only compressed when it is "
+            << "written with dagmc_export_write" << std::endl;
+
+  // read parsed command for ids on the vertices and elements
+  element_ids = data.find_keyword("element_ids");
+
+  // read parsed command for writing the OBB trees DAGMC would otherwise
+  // build when loading the file
+  build_obb = data.find_keyword("build_obb");
+
+  // read parsed command for merging coplanar surface triangles
+  decimate = data.find_keyword("decimate");
+  decimation_angle = 1.0;
+  data.get_value("decimation_angle", decimation_angle);
+  decimation_distance = GEOMETRY_RESABS;
+  data.get_value("decimation_distance", decimation_distance);
+  if (decimate)
+    message << "Decimating coplanar surface facets within " << decimation_angle
+            << " degrees and " << decimation_distance << std::endl;
+
+  // read parsed command for ordering surface vertices and facets spatially
+  reorder = data.find_keyword("reorder");
+
+  // read parsed command for surface tolerances scaled to the surface size
+  auto_tolerance = 0.0;
+  data.get_value("auto_tolerance", auto_tolerance);
+  if (auto_tolerance > 0)
+    message << "Faceting each surface to at least " << auto_tolerance
+            << " of its bounding box diagonal" << std::endl;
+
+  // read parsed command for the per-entity faceting profile
+  profile_count = 0;
+  profile_tags = data.find_keyword("profile_tags");
+  if (data.find_keyword("profile_entities") || profile_tags) {
+    profile_count = 10;
+    data.get_value("profile_entities", profile_count);
+    profile_count = std::max(profile_count, 1);
+  }
   
   if (verbose_warnings && fatal_on_curves)
     message << "This export will fail if curves fail to facet" << std::endl;
 
-  return rval;
+  return moab::MB_SUCCESS;
 }
 
 moab::ErrorCode DAGMCExportCommand::create_tags()
@@ -209,8 +740,12 @@ moab::ErrorCode DAGMCExportCommand::create_tags()
                                  geom_tag, moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT, &negone);
   CHK_MB_ERR_RET_MB("Error creating geom_tag",rval);
     
+  // Ids are set on the entity sets and, only with element_ids, on the mesh,
+  // so the tag is sparse. A dense GLOBAL_ID tag that already exists in the
+  // instance is used as is; its storage is only allocated for the sequences
+  // that are actually tagged.
   rval = mdbImpl->tag_get_handle(GLOBAL_ID_TAG_NAME, 1, moab::MB_TYPE_INTEGER,
-                                 id_tag, moab::MB_TAG_DENSE | moab::MB_TAG_CREAT, &zero);
+                                 id_tag, moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT, &zero);
   CHK_MB_ERR_RET_MB("Error creating id_tag",rval);
   
   rval = mdbImpl->tag_get_handle(NAME_TAG_NAME, NAME_TAG_SIZE, moab::MB_TYPE_OPAQUE,
@@ -229,10 +764,22 @@ moab::ErrorCode DAGMCExportCommand::create_tags()
                                  geometry_resabs_tag, moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
   CHK_MB_ERR_RET_MB("Error creating geometry_resabs_tag",rval);
 
+  if (profile_tags) {
+    rval = mdbImpl->tag_get_handle("FACET_TIME", 1, moab::MB_TYPE_DOUBLE, facet_time_tag,
+                                   moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
+    CHK_MB_ERR_RET_MB("Error creating facet time tag",rval);
+    rval = mdbImpl->tag_get_handle("FACET_POINTS", 1, moab::MB_TYPE_INTEGER, facet_points_tag,
+                                   moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
+    CHK_MB_ERR_RET_MB("Error creating facet point count tag",rval);
+    rval = mdbImpl->tag_get_handle("FACET_COUNT", 1, moab::MB_TYPE_INTEGER, facet_count_tag,
+                                   moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
+    CHK_MB_ERR_RET_MB("Error creating facet count tag",rval);
+  }
+
   return rval;
 }
 
-moab::ErrorCode DAGMCExportCommand::teardown()
+void DAGMCExportCommand::print_summary()
 {
   message  << "***** Faceting Summary Information *****" << std::endl;
   if (0 < failed_curve_count) {
@@ -247,85 +794,573 @@ moab::ErrorCode DAGMCExportCommand::teardown()
   } else {
     message << "----- All surfaces faceted correctly  -----" << std::endl;
   }
+  if (facet_cache.enabled()) {
+    message << "----- Facet Cache Information -----" << std::endl
+            << facet_cache.hits() << " cache hits, " << facet_cache.misses()
+            << " cache misses" << std::endl;
+  }
+  if (profile_count > 0 && !profiles.empty()) {
+    const size_t num_slowest = std::min(profiles.size(), (size_t)profile_count);
+    std::partial_sort(profiles.begin(), profiles.begin() + num_slowest, profiles.end(),
+                      [](const EntityProfile& a, const EntityProfile& b) {
+                        return a.seconds > b.seconds;
+                      });
+    message << "----- Slowest Entities to Facet -----" << std::endl;
+    for (size_t i = 0; i < num_slowest; ++i) {
+      const EntityProfile& p = profiles[i];
+      message << (p.dim == 1 ? "Curve " : "Surface ") << p.id << ": " << p.seconds << " s, "
+              << p.points << " points, " << p.facets << " facets" << std::endl;
+    }
+  }
   message << "***** End of Faceting Summary Information *****" << std::endl;
+
+  CubitInterface::get_cubit_message_handler()->print_message(message.str().c_str());
+  message.str("");
+}
+
+moab::ErrorCode DAGMCExportCommand::report_statistics(refentity_handle_map (&entmap)[5])
+{
+  moab::ErrorCode rval;
+  refentity_handle_map_itor ci;
+
+  // Vertices of the curves and geometric vertices, which the surface
+  // boundaries should share
+  moab::Range curve_verts;
+  for (int dim = 0; dim < 2; ++dim) {
+    for (ci = entmap[dim].begin(); ci != entmap[dim].end(); ++ci) {
+      rval = mdbImpl->get_entities_by_type(ci->second, moab::MBVERTEX, curve_verts);
+      if (moab::MB_SUCCESS != rval) return rval;
+    }
+  }
+  std::vector<double> coords(3 * curve_verts.size());
+  if (!curve_verts.empty()) {
+    rval = mdbImpl->get_coords(curve_verts, &coords[0]);
+    if (moab::MB_SUCCESS != rval) return rval;
+  }
+  std::vector<CubitVector> curve_points(curve_verts.size());
+  for (size_t i = 0; i < curve_points.size(); ++i)
+    curve_points[i] = CubitVector(coords[3*i], coords[3*i + 1], coords[3*i + 2]);
+  PointGrid grid(GEOMETRY_RESABS);
+  grid.build(curve_points);
+
+  Histogram facets_per_surface, surfaces_per_volume, edge_lengths;
+  size_t num_facets = 0, num_surface_verts = 0;
+  size_t num_boundary = 0, num_shared = 0, num_duplicates = 0;
+  std::vector<moab::EntityHandle> facets, verts;
+  std::vector<std::pair<moab::EntityHandle, moab::EntityHandle> > edges;
+  for (ci = entmap[2].begin(); ci != entmap[2].end(); ++ci) {
+    facets.clear();
+    rval = mdbImpl->get_entities_by_dimension(ci->second, 2, facets);
+    if (moab::MB_SUCCESS != rval) return rval;
+    facets_per_surface.add(facets.size());
+    num_facets += facets.size();
+
+    edges.clear();
+    verts.clear();
+    for (size_t i = 0; i < facets.size(); ++i) {
+      const moab::EntityHandle* conn;
+      int num_conn;
+      rval = mdbImpl->get_connectivity(facets[i], conn, num_conn);
+      if (moab::MB_SUCCESS != rval) return rval;
+      for (int j = 0; j < num_conn; ++j) {
+        moab::EntityHandle a = conn[j], b = conn[(j + 1) % num_conn];
+        edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+        verts.push_back(a);
+      }
+    }
+    std::sort(verts.begin(), verts.end());
+    verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+    num_surface_verts += verts.size();
+    coords.resize(3 * verts.size());
+    if (!verts.empty()) {
+      rval = mdbImpl->get_coords(&verts[0], verts.size(), &coords[0]);
+      if (moab::MB_SUCCESS != rval) return rval;
+    }
+
+    // Each edge is measured once; those of a single facet are on the
+    // boundary of the surface
+    std::sort(edges.begin(), edges.end());
+    std::vector<bool> on_boundary(verts.size(), false);
+    for (size_t i = 0; i < edges.size(); ) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i])
+        ++j;
+      size_t a = std::lower_bound(verts.begin(), verts.end(), edges[i].first) - verts.begin();
+      size_t b = std::lower_bound(verts.begin(), verts.end(), edges[i].second) - verts.begin();
+      CubitVector pa(coords[3*a], coords[3*a + 1], coords[3*a + 2]);
+      CubitVector pb(coords[3*b], coords[3*b + 1], coords[3*b + 2]);
+      edge_lengths.add((pb - pa).length());
+      if (j - i == 1)
+        on_boundary[a] = on_boundary[b] = true;
+      i = j;
+    }
+
+    // Boundary points that are not curve vertices but coincide with one
+    // are duplicates make_watertight has to merge; the others are gaps
+    for (size_t i = 0; i < verts.size(); ++i) {
+      if (!on_boundary[i])
+        continue;
+      ++num_boundary;
+      if (curve_verts.find(verts[i]) != curve_verts.end())
+        ++num_shared;
+      else if (grid.find(CubitVector(coords[3*i], coords[3*i + 1], coords[3*i + 2])) >= 0)
+        ++num_duplicates;
+    }
+  }
+  for (ci = entmap[3].begin(); ci != entmap[3].end(); ++ci) {
+    int num_children;
+    rval = mdbImpl->num_child_meshsets(ci->second, &num_children);
+    if (moab::MB_SUCCESS != rval) return rval;
+    surfaces_per_volume.add(num_children);
+  }
+  const size_t num_gaps = num_boundary - num_shared - num_duplicates;
+
+  message << "***** Export Statistics *****" << std::endl
+          << entmap[3].size() << " volumes, " << entmap[2].size() << " surfaces, "
+          << entmap[1].size() << " curves, " << num_facets << " facets, "
+          << num_surface_verts << " surface vertices" << std::endl;
+  facets_per_surface.print(message, "Facets per surface");
+  surfaces_per_volume.print(message, "Surfaces per volume");
+  edge_lengths.print(message, "Facet edge lengths");
+  if (failed_curve_count > 0) {
+    message << "Failed curves:";
+    for (size_t i = 0; i < failed_curves.size(); ++i)
+      message << " " << failed_curves[i];
+    message << std::endl;
+  }
+  if (failed_surface_count > 0) {
+    message << "Failed surfaces:";
+    for (size_t i = 0; i < failed_surfaces.size(); ++i)
+      message << " " << failed_surfaces[i];
+    message << std::endl;
+  }
+
+  message << "----- Watertightness Estimate -----" << std::endl
+          << num_boundary << " surface boundary points: " << num_shared << " shared with curves, "
+          << num_duplicates << " duplicates of curve vertices, " << num_gaps
+          << " away from any curve vertex" << std::endl;
+  if (num_surface_verts > 0)
+    message << 100.0 * num_duplicates / num_surface_verts
+            << "% of the surface vertices duplicate a curve vertex" << std::endl;
+  if (compact && !share_vertices && !make_watertight)
+    message << "Warning: compact leaves out the curve interiors, which are counted as gaps" << std::endl;
+  if (failed_curve_count > 0 || failed_surface_count > 0)
+    message << "Not watertight: some curves or surfaces could not be faceted" << std::endl;
+  else if (0 == num_gaps && 0 == num_duplicates)
+    message << "Watertight as faceted" << std::endl;
+  else if (0 == num_gaps)
+    message << "Watertight once make_watertight merges the duplicates" << std::endl;
+  else
+    message << "make_watertight has to close gaps at " << num_gaps << " points" << std::endl;
+  message << "***** End of Export Statistics *****" << std::endl;
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::teardown()
+{
+  if (report_timing)
+    timer.print(message);
+  if (!timing_file.empty() && !timer.write_json(timing_file))
+    message << "Warning: could not write timing data to " << timing_file << std::endl;
  
   CubitInterface::get_cubit_message_handler()->print_message(message.str().c_str()); 
   message.str("");
 
   
-  moab::ErrorCode rval = mdbImpl->delete_mesh();
-  CHK_MB_ERR_RET_MB("Error cleaning up mesh instance.", rval);
-  delete myGeomTool;
+  // The instance is left empty, with only the kept topology sets, or with
+  // the model handed off in memory
+  moab::ErrorCode rval = moab::MB_SUCCESS;
+  if (!keep_mesh && !in_memory) {
+    rval = reset_instance();
+    CHK_MB_ERR_RET_MB("Error cleaning up mesh instance.", rval);
+  }
+  curve_vertices.clear();
+  vertex_handles.clear();
+  mdbImpl->release_interface(readUtil);
+  readUtil = 0;
+  session->end_export();
 
   return rval;
-
 }
 
-
-moab::ErrorCode DAGMCExportCommand::create_entity_sets(refentity_handle_map (&entmap)[5])
+void DAGMCExportCommand::abort_export()
 {
+  CubitInterface::get_cubit_message_handler()->print_message(message.str().c_str());
+  message.str("");
 
-  moab::ErrorCode rval;
+  // Leave an empty instance for the next export
+  if (readUtil) {
+    mdbImpl->release_interface(readUtil);
+    readUtil = 0;
+  }
+  reset_instance();
+  curve_vertices.clear();
+  vertex_handles.clear();
+  session->end_export();
 
-  const char geom_categories[][CATEGORY_TAG_SIZE] =
-              {"Vertex\0", "Curve\0", "Surface\0", "Volume\0", "Group\0"};
-  const char* const names[] = {"Vertex", "Curve", "Surface", "Volume"};
+}
+
+bool DAGMCExportCommand::kept_model_matches()
+{
+  const ExportSession::KeptModel* kept = session->kept_model();
   DLIList<RefEntity*> entlist;
 
+  // The kept sets are listed in the order create_entity_sets found them
   for (int dim = 0; dim < 4; dim++) {
-    entlist.clean_out();
-    GeometryQueryTool::instance()->ref_entity_list(names[dim], entlist, true);
-    entlist.reset();
-
-    message << "Found " << entlist.size() << " entities of dimension " << dim << std::endl;
+    model_entities(dim, entlist);
+    if (entlist.size() != (int)kept->ids[dim].size())
+      return false;
 
-    for (int i = entlist.size(); i--;) {
+    RefEntityHandleMap::const_iterator ci = kept->sets[dim].begin();
+    for (int i = 0; i < entlist.size(); ++i, ++ci) {
       RefEntity* ent = entlist.get_and_step();
-      moab::EntityHandle handle;
+      if (ent != ci->first || ent->id() != kept->ids[dim][i])
+        return false;
+    }
+  }
 
-      // Create the new meshset
-      rval = mdbImpl->create_meshset(dim == 1 ? moab::MESHSET_ORDERED : moab::MESHSET_SET, handle);
-      if (moab::MB_SUCCESS != rval) return rval;
+  return true;
+}
 
-      // Map the geom reference entity to the corresponding moab meshset
-      entmap[dim][ent] = handle;
+moab::ErrorCode DAGMCExportCommand::clear_mesh(refentity_handle_map (&entmap)[5], bool keep_groups)
+{
+  moab::ErrorCode rval;
 
-      // Create tags for the new meshset
-      rval = mdbImpl->tag_set_data(geom_tag, &handle, 1, &dim);
-      if (moab::MB_SUCCESS != rval) return rval;
+  if (build_obb) {
+    rval = myGeomTool->delete_all_obb_trees();
+    CHK_MB_ERR_RET_MB("Error deleting OBB trees: ", rval);
+  }
 
-      int id = ent->id();
-      rval = mdbImpl->tag_set_data(id_tag, &handle, 1, &id);
-      if (moab::MB_SUCCESS != rval) return rval;
+  std::vector<moab::EntityHandle> set_list;
+  for (int dim = 0; dim < 4; ++dim) {
+    for (refentity_handle_map_itor ci = entmap[dim].begin(); ci != entmap[dim].end(); ++ci)
+      set_list.push_back(ci->second);
+  }
 
-      rval = mdbImpl->tag_set_data(category_tag, &handle, 1, &geom_categories[dim]);
-      if (moab::MB_SUCCESS != rval) return rval;
+  // Empty the topology sets, vertex sets included; their parents, children
+  // and senses stay
+  if (!set_list.empty()) {
+    rval = mdbImpl->clear_meshset(&set_list[0], set_list.size());
+    CHK_MB_ERR_RET_MB("Error emptying topology sets: ", rval);
+  }
+
+  // Groups only hold sets and are kept as they are
+  if (keep_groups) {
+    for (refentity_handle_map_itor ci = entmap[4].begin(); ci != entmap[4].end(); ++ci)
+      set_list.push_back(ci->second);
+  }
+  moab::Range kept_sets;
+  for (size_t i = 0; i < set_list.size(); ++i)
+    kept_sets.insert(set_list[i]);
+
+  // Everything else, the file set included, is made again
+  moab::Range sets;
+  rval = mdbImpl->get_entities_by_type(0, moab::MBENTITYSET, sets);
+  CHK_MB_ERR_RET_MB("Error getting entity sets: ", rval);
+  sets = subtract(sets, kept_sets);
+  rval = mdbImpl->delete_entities(sets);
+  CHK_MB_ERR_RET_MB("Error deleting entity sets: ", rval);
+  for (int dim = 3; dim >= 0; --dim) {
+    moab::Range ents;
+    rval = mdbImpl->get_entities_by_dimension(0, dim, ents);
+    CHK_MB_ERR_RET_MB("Error getting mesh entities: ", rval);
+    rval = mdbImpl->delete_entities(ents);
+    CHK_MB_ERR_RET_MB("Error deleting mesh entities: ", rval);
+  }
+  // The vertices are made again in the emptied vertex sets
+  curve_vertices.clear();
+  vertex_handles.clear();
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::keep_topology(refentity_handle_map (&entmap)[5])
+{
+  // Groups are made again by the next export
+  moab::ErrorCode rval = clear_mesh(entmap, false);
+  if (moab::MB_SUCCESS != rval)
+    return rval;
+
+  ExportSession::KeptModel kept;
+  for (int dim = 0; dim < 4; ++dim) {
+    for (refentity_handle_map_itor ci = entmap[dim].begin(); ci != entmap[dim].end(); ++ci) {
+      kept.sets[dim].insert(ci->first, ci->second);
+      kept.ids[dim].push_back(ci->first->id());
     }
   }
 
+  rval = delete_export_tags(false);
+  if (moab::MB_SUCCESS != rval)
+    return rval;
+
+  session->keep_model(kept);
   return moab::MB_SUCCESS;
 }
 
-moab::ErrorCode DAGMCExportCommand::create_topology(refentity_handle_map (&entitymap)[5])
+moab::ErrorCode DAGMCExportCommand::reset_instance()
 {
-  moab::ErrorCode rval;
-  DLIList<RefEntity*> entitylist;
-  refentity_handle_map_itor ci;
+  moab::ErrorCode rval = session->reset();
+  CHK_MB_ERR_RET_MB("Error deleting mesh: ", rval);
+  forget_tag_handles(true);
 
-  for (int dim = 1; dim < 4; ++dim) {
-    for (ci = entitymap[dim].begin(); ci != entitymap[dim].end(); ++ci) {
-      entitylist.clean_out();
-      ci->first->get_child_ref_entities(entitylist);
+  myGeomTool = session->geom_tool();
+  mw = session->watertight();
+  return moab::MB_SUCCESS;
+}
 
-      entitylist.reset();
-      for (int i = entitylist.size(); i--; ) {
-        RefEntity* ent = entitylist.get_and_step();
-        moab::EntityHandle h = entitymap[dim - 1][ent];
-        rval = mdbImpl->add_parent_child(ci->second, h);
+moab::ErrorCode DAGMCExportCommand::delete_export_tags(bool topology)
+{
+  moab::ErrorCode rval = session->delete_export_tags(topology);
+  CHK_MB_ERR_RET_MB("Error deleting export tags: ", rval);
+  forget_tag_handles(topology);
+  return moab::MB_SUCCESS;
+}
 
-        if (moab::MB_SUCCESS != rval)
-          return rval;
-      }
+void DAGMCExportCommand::forget_tag_handles(bool topology)
+{
+  faceting_tol_tag = geometry_resabs_tag = 0;
+  surface_faceting_tol_tag = surface_normal_tol_tag = 0;
+  facet_time_tag = facet_points_tag = facet_count_tag = 0;
+  extra_name_tags.clear();
+  if (topology)
+    name_tag = category_tag = 0;
+}
+
+
+namespace {
+
+bool lower_id(RefEntity* a, RefEntity* b)
+{
+  return a->id() < b->id();
+}
+
+}
+
+moab::ErrorCode DAGMCExportCommand::select_entities(CubitCommandData &data)
+{
+  for (int dim = 0; dim < 4; ++dim)
+    selection[dim].clear();
+  selected.clear();
+
+  std::vector<int> volume_ids;
+  std::vector<std::string> group_names;
+  data.get_values("volume", volume_ids);
+  data.get_strings("group", group_names);
+  if (volume_ids.empty() && group_names.empty())
+    return moab::MB_SUCCESS;
+
+  DLIList<RefEntity*> members;
+  for (size_t i = 0; i < volume_ids.size(); ++i) {
+    RefVolume* vol = GeometryQueryTool::instance()->get_ref_volume(volume_ids[i]);
+    if (!vol) {
+      message << "No volume with id " << volume_ids[i] << std::endl;
+      return moab::MB_ENTITY_NOT_FOUND;
+    }
+    members.append(vol);
+  }
+  for (size_t i = 0; i < group_names.size(); ++i) {
+    RefEntity* grp = RefEntityName::instance()->get_refentity(CubitString(group_names[i].c_str()));
+    if (!dynamic_cast<RefGroup*>(grp)) {
+      message << "No group named " << group_names[i] << std::endl;
+      return moab::MB_ENTITY_NOT_FOUND;
+    }
+    members.append(grp);
+  }
+
+  // Groups are searched for volumes through their bodies and sub-groups
+  std::set<RefEntity*> visited;
+  while (members.size()) {
+    RefEntity* ent = members.pop();
+    if (!visited.insert(ent).second)
+      continue;
+    if (RefVolume* vol = dynamic_cast<RefVolume*>(ent)) {
+      selection[3].push_back(vol);
+    }
+    else if (Body* body = dynamic_cast<Body*>(ent)) {
+      DLIList<RefVolume*> vols;
+      body->ref_volumes(vols);
+      for (int k = vols.size(); k--; )
+        members.append(vols.get_and_step());
+    }
+    else if (dynamic_cast<RefGroup*>(ent)) {
+      DLIList<RefEntity*> children;
+      ent->get_child_ref_entities(children);
+      for (int k = children.size(); k--; )
+        members.append(children.get_and_step());
+    }
+  }
+  if (selection[3].empty()) {
+    message << "The selected groups hold no volumes" << std::endl;
+    return moab::MB_ENTITY_NOT_FOUND;
+  }
+
+  // The closure of the volumes, without visiting the rest of the model
+  std::set<RefEntity*> closure[3];
+  for (size_t i = 0; i < selection[3].size(); ++i) {
+    RefVolume* vol = (RefVolume*)selection[3][i];
+    DLIList<RefFace*> faces;
+    DLIList<RefEdge*> edges;
+    DLIList<RefVertex*> verts;
+    vol->ref_faces(faces);
+    vol->ref_edges(edges);
+    vol->ref_vertices(verts);
+    for (int k = faces.size(); k--; )
+      closure[2].insert(faces.get_and_step());
+    for (int k = edges.size(); k--; )
+      closure[1].insert(edges.get_and_step());
+    for (int k = verts.size(); k--; )
+      closure[0].insert(verts.get_and_step());
+  }
+  for (int dim = 0; dim < 3; ++dim)
+    selection[dim].assign(closure[dim].begin(), closure[dim].end());
+
+  // Sets are made in id order, as for the whole model
+  for (int dim = 0; dim < 4; ++dim) {
+    std::sort(selection[dim].begin(), selection[dim].end(), lower_id);
+    selected.insert(selection[dim].begin(), selection[dim].end());
+  }
+
+  message << "Selected " << selection[3].size() << " volumes with "
+          << selection[2].size() << " surfaces" << std::endl;
+
+  return moab::MB_SUCCESS;
+}
+
+void DAGMCExportCommand::model_entities(int dim, DLIList<RefEntity*>& entlist)
+{
+  const char* const names[] = {"Vertex", "Curve", "Surface", "Volume"};
+
+  entlist.clean_out();
+  if (selected.empty()) {
+    GeometryQueryTool::instance()->ref_entity_list(names[dim], entlist, true);
+  }
+  else {
+    for (size_t i = 0; i < selection[dim].size(); ++i)
+      entlist.append(selection[dim][i]);
+  }
+  entlist.reset();
+}
+
+bool DAGMCExportCommand::holds_selection(RefEntity* ent)
+{
+  if (selected.count(ent))
+    return true;
+  if (Body* body = dynamic_cast<Body*>(ent)) {
+    DLIList<RefVolume*> vols;
+    body->ref_volumes(vols);
+    for (int k = vols.size(); k--; ) {
+      if (selected.count(vols.get_and_step()))
+        return true;
+    }
+  }
+  else if (dynamic_cast<RefGroup*>(ent)) {
+    DLIList<RefEntity*> children;
+    ent->get_child_ref_entities(children);
+    for (int k = children.size(); k--; ) {
+      if (holds_selection(children.get_and_step()))
+        return true;
+    }
+  }
+  return false;
+}
+
+moab::ErrorCode DAGMCExportCommand::create_entity_sets(refentity_handle_map (&entmap)[5])
+{
+
+  moab::ErrorCode rval;
+
+  const char geom_categories[][CATEGORY_TAG_SIZE] =
+              {"Vertex\0", "Curve\0", "Surface\0", "Volume\0", "Group\0"};
+  const char* const names[] = {"Vertex", "Curve", "Surface", "Volume"};
+  DLIList<RefEntity*> entlist;
+
+  for (int dim = 0; dim < 4; dim++) {
+    model_entities(dim, entlist);
+
+    message << "Found " << entlist.size() << " entities of dimension " << dim << std::endl;
+
+    for (int i = entlist.size(); i--;) {
+      RefEntity* ent = entlist.get_and_step();
+      moab::EntityHandle handle;
+
+      // Create the new meshset
+      rval = mdbImpl->create_meshset(dim == 1 ? moab::MESHSET_ORDERED : moab::MESHSET_SET, handle);
+      if (moab::MB_SUCCESS != rval) return rval;
+
+      // Map the geom reference entity to the corresponding moab meshset
+      if (!entmap[dim].insert(ent, handle)) {
+        message << "Duplicate " << names[dim] << " id " << ent->id() << std::endl;
+        return moab::MB_FAILURE;
+      }
+
+      // Create tags for the new meshset
+      rval = mdbImpl->tag_set_data(geom_tag, &handle, 1, &dim);
+      if (moab::MB_SUCCESS != rval) return rval;
+
+      int id = ent->id();
+      rval = mdbImpl->tag_set_data(id_tag, &handle, 1, &id);
+      if (moab::MB_SUCCESS != rval) return rval;
+
+      rval = mdbImpl->tag_set_data(category_tag, &handle, 1, &geom_categories[dim]);
+      if (moab::MB_SUCCESS != rval) return rval;
+    }
+  }
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::create_topology(refentity_handle_map (&entitymap)[5])
+{
+  moab::ErrorCode rval;
+  DLIList<RefEntity*> entitylist;
+  refentity_handle_map_itor ci;
+
+  // The links are gathered first and stored one set at a time, in the same
+  // order add_parent_child would store them link by link
+  std::vector<moab::EntityHandle> children;
+  std::vector<std::vector<moab::EntityHandle> > parents[3];
+  for (int dim = 0; dim < 3; ++dim)
+    parents[dim].resize(entitymap[dim].size());
+
+  for (int dim = 1; dim < 4; ++dim) {
+    const refentity_handle_map& child_map = entitymap[dim - 1];
+    for (ci = entitymap[dim].begin(); ci != entitymap[dim].end(); ++ci) {
+      entitylist.clean_out();
+      ci->first->get_child_ref_entities(entitylist);
+
+      children.clear();
+      entitylist.reset();
+      for (int i = entitylist.size(); i--; ) {
+        RefEntity* ent = entitylist.get_and_step();
+        // The position of the child in its map also indexes its parent list
+        size_t child = child_map.position(ent);
+        if (child == child_map.size()) {
+          message << "No entity set for child " << ent->id() << " of entity "
+                  << ci->first->id() << " with dimension " << dim << std::endl;
+          return moab::MB_ENTITY_NOT_FOUND;
+        }
+        children.push_back(child_map.begin()[child].second);
+        parents[dim - 1][child].push_back(ci->second);
+      }
+
+      if (!children.empty()) {
+        rval = mdbImpl->add_child_meshsets(ci->second, &children[0], children.size());
+        if (moab::MB_SUCCESS != rval)
+          return rval;
+      }
+    }
+  }
+
+  for (int dim = 0; dim < 3; ++dim) {
+    size_t index = 0;
+    for (ci = entitymap[dim].begin(); ci != entitymap[dim].end(); ++ci, ++index) {
+      const std::vector<moab::EntityHandle>& set_parents = parents[dim][index];
+      if (set_parents.empty())
+        continue;
+      rval = mdbImpl->add_parent_meshsets(ci->second, &set_parents[0], set_parents.size());
+      if (moab::MB_SUCCESS != rval)
+        return rval;
     }
   }
 
@@ -337,6 +1372,7 @@ moab::ErrorCode DAGMCExportCommand::store_surface_senses(refentity_handle_map& s
 {
   moab::ErrorCode rval;
   refentity_handle_map_itor ci;
+  std::vector<moab::EntityHandle> surfaces, sense_data;
 
   for (ci = surface_map.begin(); ci != surface_map.end(); ++ci) {
     RefFace* face = (RefFace*)(ci->first);
@@ -369,14 +1405,37 @@ moab::ErrorCode DAGMCExportCommand::store_surface_senses(refentity_handle_map& s
       }
     }
 
+    if (!forward && !reverse)
+      continue;
+
+    // The sense tag holds the forward and the reverse volume
+    moab::EntityHandle vols[2] = {0, 0};
+    // Volumes outside the selection are left out, so their side of the
+    // surface is bounded by the implicit complement
     if (forward) {
-      rval = myGeomTool->set_sense(ci->second, volume_map[forward], moab::SENSE_FORWARD);
-      if (moab::MB_SUCCESS != rval) return rval;
+      vols[0] = volume_map.find(forward);
+      if (!vols[0] && selected.empty()) {
+        message << "No entity set for volume " << forward->id() << " of surface " << face->id() << std::endl;
+        return moab::MB_ENTITY_NOT_FOUND;
+      }
     }
     if (reverse) {
-      rval = myGeomTool->set_sense(ci->second, volume_map[reverse], moab::SENSE_REVERSE);
-      if (moab::MB_SUCCESS != rval) return rval;
+      vols[1] = volume_map.find(reverse);
+      if (!vols[1] && selected.empty()) {
+        message << "No entity set for volume " << reverse->id() << " of surface " << face->id() << std::endl;
+        return moab::MB_ENTITY_NOT_FOUND;
+      }
     }
+    surfaces.push_back(ci->second);
+    sense_data.push_back(vols[0]);
+    sense_data.push_back(vols[1]);
+  }
+
+  // Tag all surfaces at once rather than through GeomTopoTool::set_sense
+  if (!surfaces.empty()) {
+    rval = mdbImpl->tag_set_data(myGeomTool->get_sense_tag(), &surfaces[0], surfaces.size(),
+                                 &sense_data[0]);
+    if (moab::MB_SUCCESS != rval) return rval;
   }
 
   return moab::MB_SUCCESS;
@@ -386,32 +1445,81 @@ moab::ErrorCode DAGMCExportCommand::store_curve_senses(refentity_handle_map& cur
                                       refentity_handle_map& surface_map)
 {
   moab::ErrorCode rval;
-  std::vector<moab::EntityHandle> ents;
-  std::vector<int> senses;
   refentity_handle_map_itor ci;
+
+  // The senses of all curves are gathered into flat arrays and tagged at
+  // once rather than through GeomTopoTool::set_senses
+  std::vector<moab::EntityHandle> curves, ents;
+  std::vector<int> senses;
+  std::vector<size_t> offsets;
   for (ci = curve_map.begin(); ci != curve_map.end(); ++ci) {
     RefEdge* edge = (RefEdge*)(ci->first);
-    ents.clear();
-    senses.clear();
+    const size_t offset = ents.size();
     for (SenseEntity* ce = edge->get_first_sense_entity_ptr();
          ce; ce = ce->next_on_bte()) {
       BasicTopologyEntity* fac = ce->get_parent_basic_topology_entity_ptr();
-      moab::EntityHandle face = surface_map[fac];
-      if (ce->get_sense() == CUBIT_UNKNOWN ||
-          ce->get_sense() != edge->get_curve_ptr()->bridge_sense()) {
-        ents.push_back(face);
-        senses.push_back(moab::SENSE_REVERSE);
+      moab::EntityHandle face = surface_map.find(fac);
+      // Surfaces outside the selected volumes are left out
+      if (!face && !selected.empty())
+        continue;
+      if (!face) {
+        message << "No entity set for surface " << fac->id() << " of curve " << edge->id() << std::endl;
+        return moab::MB_ENTITY_NOT_FOUND;
       }
+      int face_senses[2];
+      int num_senses = 0;
+      if (ce->get_sense() == CUBIT_UNKNOWN ||
+          ce->get_sense() != edge->get_curve_ptr()->bridge_sense())
+        face_senses[num_senses++] = moab::SENSE_REVERSE;
       if (ce->get_sense() == CUBIT_UNKNOWN ||
-          ce->get_sense() == edge->get_curve_ptr()->bridge_sense()) {
-        ents.push_back(face);
-        senses.push_back(moab::SENSE_FORWARD);
+          ce->get_sense() == edge->get_curve_ptr()->bridge_sense())
+        face_senses[num_senses++] = moab::SENSE_FORWARD;
+
+      // Merge senses with the same surface as set_sense does: a repeated
+      // sense is dropped and opposite senses become SENSE_BOTH
+      for (int j = 0; j < num_senses; ++j) {
+        std::vector<moab::EntityHandle>::iterator it =
+          std::find(ents.begin() + offset, ents.end(), face);
+        if (it == ents.end()) {
+          ents.push_back(face);
+          senses.push_back(face_senses[j]);
+          continue;
+        }
+        int& sense = senses[it - ents.begin()];
+        if (sense == face_senses[j])
+          continue;
+        if (moab::SENSE_BOTH != sense && sense + face_senses[j] != 0) {
+          message << "Incoherent senses of curve " << edge->id() << " with surface "
+                  << fac->id() << std::endl;
+          return moab::MB_FAILURE;
+        }
+        sense = moab::SENSE_BOTH;
       }
     }
 
-    rval = myGeomTool->set_senses(ci->second, ents, senses);
-    if (moab::MB_SUCCESS != rval) return rval;
+    if (ents.size() > offset) {
+      curves.push_back(ci->second);
+      offsets.push_back(offset);
+    }
+  }
+  if (curves.empty())
+    return moab::MB_SUCCESS;
+  offsets.push_back(ents.size());
+
+  std::vector<const void*> ent_ptrs(curves.size()), sense_ptrs(curves.size());
+  std::vector<int> sizes(curves.size());
+  for (size_t i = 0; i < curves.size(); ++i) {
+    ent_ptrs[i] = &ents[offsets[i]];
+    sense_ptrs[i] = &senses[offsets[i]];
+    sizes[i] = offsets[i + 1] - offsets[i];
   }
+  rval = mdbImpl->tag_set_by_ptr(myGeomTool->get_senseNEnts_tag(), &curves[0], curves.size(),
+                                 &ent_ptrs[0], &sizes[0]);
+  if (moab::MB_SUCCESS != rval) return rval;
+  rval = mdbImpl->tag_set_by_ptr(myGeomTool->get_senseNSenses_tag(), &curves[0], curves.size(),
+                                 &sense_ptrs[0], &sizes[0]);
+  if (moab::MB_SUCCESS != rval) return rval;
+
   return moab::MB_SUCCESS;
 }
 
@@ -439,7 +1547,7 @@ moab::ErrorCode DAGMCExportCommand::create_group_entsets(refentity_handle_map& g
   DLIList<RefEntity*> entitylist;
 
   // Create entity sets for all ref groups
-  std::vector<moab::Tag> extra_name_tags;
+  extra_name_tags.clear();
   DLIList<CubitString> name_list;
   entitylist.clean_out();
 
@@ -456,6 +1564,9 @@ moab::ErrorCode DAGMCExportCommand::create_group_entsets(refentity_handle_map& g
     RefEntityName::instance()->get_refentity_name(grp, name_list);
     if (name_list.size() == 0)
       continue;
+    // Groups without any of the selected volumes are left out
+    if (!selected.empty() && !holds_selection(grp))
+      continue;
     // Set pointer to first name of the group and set the first name to name1
     name_list.reset();
     CubitString name1 = name_list.get();
@@ -510,7 +1621,7 @@ moab::ErrorCode DAGMCExportCommand::create_group_entsets(refentity_handle_map& g
       }
     }
     // Add the group handle
-    group_map[grp] = h;
+    group_map.insert(grp, h);
   }
 
   return moab::MB_SUCCESS;
@@ -535,9 +1646,9 @@ moab::ErrorCode DAGMCExportCommand::store_group_content(refentity_handle_map (&e
 
       if (dim < 0) {
         Body* body;
-        if (entitymap[4].find(ent) != entitymap[4].end()) {
+        if (entitymap[4].contains(ent)) {
           // Child is another group; examine its contents
-          entities.insert(entitymap[4][ent]);
+          entities.insert(entitymap[4].find(ent));
         }
         else if ((body = dynamic_cast<Body*>(ent)) != NULL) {
           // Child is a CGM Body, which presumably comprises some volumes--
@@ -546,9 +1657,9 @@ moab::ErrorCode DAGMCExportCommand::store_group_content(refentity_handle_map (&e
           body->ref_volumes(vols);
           for (int vi = vols.size(); vi--; ) {
             RefVolume* vol = vols.get_and_step();
-            if (entitymap[3].find(vol) != entitymap[3].end()) {
-              entities.insert(entitymap[3][vol]);
-            } else {
+            if (entitymap[3].contains(vol)) {
+              entities.insert(entitymap[3].find(vol));
+            } else if (selected.empty()) {
               message << "Warning: CGM Body has orphan RefVolume" << std::endl;
             }
           }
@@ -558,8 +1669,8 @@ moab::ErrorCode DAGMCExportCommand::store_group_content(refentity_handle_map (&e
         }
       }
       else if (dim < 4) {
-        if (entitymap[dim].find(ent) != entitymap[dim].end())
-          entities.insert(entitymap[dim][ent]);
+        if (entitymap[dim].contains(ent))
+          entities.insert(entitymap[dim].find(ent));
       }
     }
 
@@ -572,12 +1683,16 @@ moab::ErrorCode DAGMCExportCommand::store_group_content(refentity_handle_map (&e
   return moab::MB_SUCCESS;
 }
 
-moab::ErrorCode DAGMCExportCommand::create_vertices(refentity_handle_map &vertex_map)
+moab::ErrorCode DAGMCExportCommand::create_vertices(const refentity_handle_map &vertex_sets,
+                                                    refentity_handle_map &vertex_map)
 {
   moab::ErrorCode rval;
-  refentity_handle_map_itor ci;
+  refentity_handle_map::const_iterator ci;
 
-  for (ci = vertex_map.begin(); ci != vertex_map.end(); ++ci) {
+  // The vertex sets stay in vertex_sets, as the topology of every export
+  // made from them; vertex_map gets the vertex in each set
+  vertex_map.clear();
+  for (ci = vertex_sets.begin(); ci != vertex_sets.end(); ++ci) {
     CubitVector pos = dynamic_cast<RefVertex*>(ci->first)->coordinates();
     double coords[3] = {pos.x(), pos.y(), pos.z()};
     moab::EntityHandle vh;
@@ -589,137 +1704,249 @@ moab::ErrorCode DAGMCExportCommand::create_vertices(refentity_handle_map &vertex
     rval = mdbImpl->add_entities(ci->second, &vh, 1);
     if (moab::MB_SUCCESS != rval) return rval;
 
-    // point map entry at vertex handle instead of meshset handle to
-    // simplify future operations
-    ci->second = vh;
+    vertex_map.insert(ci->first, vh);
+  }
+
+  return moab::MB_SUCCESS;
+}
+
+
+moab::ErrorCode DAGMCExportCommand::resolve_tolerances(refentity_handle_map& curve_map,
+                                                       refentity_handle_map& surface_map)
+{
+  moab::ErrorCode rval;
+  entity_tolerances.clear();
+  const FacetTolerance global = {faceting_tol, norm_tol};
+
+  // Surfaces scaled to their size
+  refentity_handle_map_itor ci;
+  if (auto_tolerance > 0) {
+    for (ci = surface_map.begin(); ci != surface_map.end(); ++ci) {
+      FacetTolerance tol = global;
+      tol.faceting = std::max(faceting_tol, auto_tolerance * ci->first->bounding_box().diagonal_length());
+      entity_tolerances[ci->first] = tol;
+    }
+  }
+
+  // Groups named e.g. 'facet_tol:1e-2' or 'facet_tol:1e-2/norm_tol:10' set the
+  // tolerance of the surfaces they hold, directly or through volumes, bodies
+  // or other groups; the finest of several overrides is used
+  std::map<RefEntity*, FacetTolerance> group_tolerances;
+  DLIList<RefEntity*> groups, members;
+  DLIList<CubitString> names;
+  GeometryQueryTool::instance()->ref_entity_list("group", groups);
+  groups.reset();
+  for (int i = groups.size(); i--; ) {
+    RefEntity* grp = groups.get_and_step();
+    names.clean_out();
+    RefEntityName::instance()->get_refentity_name(grp, names);
+    names.reset();
+    double group_faceting = 0;
+    int group_normal = 0;
+    for (int j = names.size(); j--; ) {
+      std::string name = names.get_and_step().c_str();
+      std::istringstream parts(name);
+      std::string part;
+      while (std::getline(parts, part, '/')) {
+        if (0 == part.compare(0, 10, "facet_tol:"))
+          group_faceting = std::atof(part.c_str() + 10);
+        else if (0 == part.compare(0, 9, "norm_tol:"))
+          group_normal = std::atoi(part.c_str() + 9);
+      }
+    }
+    if (group_faceting <= 0 && group_normal <= 0)
+      continue;
+    message << "Group " << grp->id() << " sets faceting tolerance "
+            << (group_faceting > 0 ? group_faceting : faceting_tol) << " and normal tolerance "
+            << (group_normal > 0 ? group_normal : norm_tol) << std::endl;
+
+    // Collect the surfaces of the group
+    std::set<RefEntity*> visited, faces;
+    members.clean_out();
+    members.append(grp);
+    while (members.size()) {
+      RefEntity* ent = members.pop();
+      if (!visited.insert(ent).second)
+        continue;
+      if (2 == ent->dimension()) {
+        faces.insert(ent);
+      }
+      else if (RefVolume* vol = dynamic_cast<RefVolume*>(ent)) {
+        DLIList<RefFace*> vol_faces;
+        vol->ref_faces(vol_faces);
+        for (int k = vol_faces.size(); k--; )
+          faces.insert(vol_faces.get_and_step());
+      }
+      else if (Body* body = dynamic_cast<Body*>(ent)) {
+        DLIList<RefVolume*> vols;
+        body->ref_volumes(vols);
+        for (int k = vols.size(); k--; )
+          members.append(vols.get_and_step());
+      }
+      else if (dynamic_cast<RefGroup*>(ent)) {
+        DLIList<RefEntity*> children;
+        ent->get_child_ref_entities(children);
+        for (int k = children.size(); k--; )
+          members.append(children.get_and_step());
+      }
+    }
+
+    FacetTolerance tol = global;
+    if (group_faceting > 0)
+      tol.faceting = group_faceting;
+    if (group_normal > 0)
+      tol.normal = group_normal;
+    for (std::set<RefEntity*>::iterator fi = faces.begin(); fi != faces.end(); ++fi) {
+      if (!surface_map.contains(*fi))
+        continue;
+      std::map<RefEntity*, FacetTolerance>::iterator gi = group_tolerances.find(*fi);
+      if (gi == group_tolerances.end()) {
+        group_tolerances[*fi] = tol;
+      } else {
+        gi->second.faceting = std::min(gi->second.faceting, tol.faceting);
+        gi->second.normal = std::min(gi->second.normal, tol.normal);
+      }
+    }
+  }
+
+  // Group overrides replace the automatic tolerance
+  for (std::map<RefEntity*, FacetTolerance>::iterator gi = group_tolerances.begin();
+       gi != group_tolerances.end(); ++gi)
+    entity_tolerances[gi->first] = gi->second;
+  if (entity_tolerances.empty())
+    return moab::MB_SUCCESS;
+
+  // Curves use the finest tolerance of the surfaces they bound, so that
+  // their facets match those of every adjacent surface
+  for (ci = curve_map.begin(); ci != curve_map.end(); ++ci) {
+    DLIList<RefFace*> faces;
+    dynamic_cast<RefEdge*>(ci->first)->ref_faces(faces);
+    if (faces.size() == 0)
+      continue;
+    FacetTolerance tol = tolerance_of(faces.get_and_step());
+    for (int i = faces.size() - 1; i--; ) {
+      FacetTolerance other = tolerance_of(faces.get_and_step());
+      tol.faceting = std::min(tol.faceting, other.faceting);
+      tol.normal = std::min(tol.normal, other.normal);
+    }
+    if (tol.faceting != faceting_tol || tol.normal != norm_tol)
+      entity_tolerances[ci->first] = tol;
   }
 
+  rval = mdbImpl->tag_get_handle("SURFACE_FACETING_TOL", 1, moab::MB_TYPE_DOUBLE, surface_faceting_tol_tag,
+                                 moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
+  CHK_MB_ERR_RET_MB("Error creating surface faceting tolerance tag",rval);
+  rval = mdbImpl->tag_get_handle("SURFACE_NORMAL_TOL", 1, moab::MB_TYPE_INTEGER, surface_normal_tol_tag,
+                                 moab::MB_TAG_SPARSE | moab::MB_TAG_CREAT);
+  CHK_MB_ERR_RET_MB("Error creating surface normal tolerance tag",rval);
+
+  message << "Using individual faceting tolerances for " << entity_tolerances.size()
+          << " curves and surfaces" << std::endl;
+
   return moab::MB_SUCCESS;
 }
 
+FacetTolerance DAGMCExportCommand::tolerance_of(RefEntity* ent) const
+{
+  std::map<RefEntity*, FacetTolerance>::const_iterator ti = entity_tolerances.find(ent);
+  if (ti != entity_tolerances.end())
+    return ti->second;
+  FacetTolerance global = {faceting_tol, norm_tol};
+  return global;
+}
 
 moab::ErrorCode DAGMCExportCommand::create_curve_facets(refentity_handle_map& curve_map,
                                        refentity_handle_map& vertex_map)
 {
   moab::ErrorCode rval;
-  CubitStatus s;
 
   // Maximum allowable curve-endpoint proximity warnings
   // If this integer becomes negative, then abs(curve_warnings) is the
   // number of warnings that were suppressed.
   int curve_warnings = 0;
-  failed_curve_count = 0;
 
   // Map iterator
   refentity_handle_map_itor ci;
-  
-  // Create geometry for all curves
-  GMem data;
-  for (ci = curve_map.begin(); ci != curve_map.end(); ++ci) {
-    // Get the start and end points of the curve in the form of a reference edge
-    RefEdge* edge = dynamic_cast<RefEdge*>(ci->first);
-    // Get the edge's curve information
-    Curve* curve = edge->get_curve_ptr();
-    // Clean out previous curve information
-    data.clear();
-    // Facet curve according to parameters and CGM version
-    s = edge->get_graphics(data, norm_tol, faceting_tol);
-    
-    if( s != CUBIT_SUCCESS )
-      {
-        // if we fatal on curves
-        if(fatal_on_curves)
-          {  
-             message << "Failed to facet the curve " << edge->id() << std::endl;
-             return moab::MB_FAILURE;
-           }
-        // otherwise record them
-        else
-          {
-            failed_curve_count++;
-            failed_curves.push_back(edge->id());
-          }
-        continue;
+
+  // Curves are processed in chunks like surfaces: the cache lookups may run
+  // concurrently around the serialized CGM tessellation, while failures,
+  // warnings and MOAB entities are handled serially in curve_map order.
+  // tight_memory only keeps one tessellation per thread at a time
+  const size_t chunk_size = num_threads > 1 && !tight_memory ? 64 * (size_t)num_threads : num_threads;
+  std::vector<CurveFacets> chunk(chunk_size);
+  std::vector<GMem> chunk_data(chunk_size);
+  size_t num_in_chunk;
+
+  // With fatal_on_curves the export stops at the first failed curve, so the
+  // remaining tessellations of the chunk are skipped
+  std::atomic<bool> failed(false);
+
+  progress.start("Faceting curves", curve_map.size(),
+                 census.curves ? census.curve_points * curve_map.size() / census.curves : 0);
+
+  ci = curve_map.begin();
+  while (ci != curve_map.end()) {
+    for (num_in_chunk = 0; ci != curve_map.end() && num_in_chunk < chunk_size; ++ci) {
+      CurveFacets& curve = chunk[num_in_chunk];
+      curve.clear();
+      curve.data = &chunk_data[num_in_chunk++];
+      curve.edge = dynamic_cast<RefEdge*>(ci->first);
+      curve.handle = ci->second;
+
+      // Reuse the previous tessellation if the curve has not changed
+      curve.tolerance = tolerance_of(curve.edge);
+      if (incremental || facet_cache.enabled()) {
+        curve.signature = GeometrySignature::of_curve(curve.edge);
+        if (entity_tolerances.count(curve.edge))
+          curve.signature.add_tolerance(curve.tolerance.faceting, curve.tolerance.normal);
       }
-    
-    std::vector<CubitVector> points = data.point_list();
-    
-    // Need to reverse data?
-    if (curve->bridge_sense() == CUBIT_REVERSED) 
-      std::reverse(points.begin(), points.end());
-    
-    // Check for closed curve
-    RefVertex *start_vtx, *end_vtx;
-    start_vtx = edge->start_vertex();
-    end_vtx = edge->end_vertex();
-    
-    // Special case for point curve
-    if (points.size() < 2) {
-      if (start_vtx != end_vtx || curve->measure() > GEOMETRY_RESABS) {
-        message << "Warning: No facetting for curve " << edge->id() << std::endl;
-        continue;
+      if (incremental) {
+        std::map<int, CachedFacets>::iterator cached = curve_cache.find(curve.edge->id());
+        if (cached != curve_cache.end() && cached->second.signature == curve.signature)
+          curve.cached = &cached->second;
       }
-      moab::EntityHandle h = vertex_map[start_vtx];
-      rval = mdbImpl->add_entities(ci->second, &h, 1);
-      if (moab::MB_SUCCESS != rval)
-        return moab::MB_FAILURE;
-      continue;
     }
-    // Check to see if the first and last interior vertices are considered to be
-    // coincident by CUBIT
-    const bool closed = (points.front() - points.back()).length() < GEOMETRY_RESABS;
-    if (closed != (start_vtx == end_vtx)) {
-      message << "Warning: topology and geometry inconsistant for possibly closed curve "
-              << edge->id() << std::endl;
-    }
-    
-    // Check proximity of vertices to end coordinates
-    if ((start_vtx->coordinates() - points.front()).length() > GEOMETRY_RESABS ||
-        (end_vtx->coordinates() - points.back()).length() > GEOMETRY_RESABS) {
-      
-      curve_warnings--;
-      if (curve_warnings >= 0 || verbose_warnings) {
-        message << "Warning: vertices not at ends of curve " << edge->id() << std::endl;
-        if (curve_warnings == 0 && !verbose_warnings) {
-          message << "         further instances of this warning will be suppressed..." << std::endl;
-        }
+
+    // An interrupt stops the workers from starting more tessellations and
+    // leaves the rest of the chunk undone
+    parallel_for(num_in_chunk, num_threads, [&](size_t i) {
+      if (fatal_on_curves && failed) {
+        chunk[i].skipped = true;
+        return;
       }
+      facet_curve(chunk[i]);
+      if (CUBIT_SUCCESS != chunk[i].status)
+        failed = true;
+    }, [&]() { return progress.check_interrupt(); });
+    if (progress.cancelled()) {
+      message << "Export interrupted while faceting curves" << std::endl;
+      return moab::MB_FAILURE;
     }
 
-    // Create interior points
-    std::vector<moab::EntityHandle> verts, edges;
-    verts.push_back(vertex_map[start_vtx]);
-    for (size_t i = 1; i < points.size() - 1; ++i) {
-      double coords[] = {points[i].x(), points[i].y(), points[i].z()};
-      moab::EntityHandle h;
-      // Create vertex entity
-      rval = mdbImpl->create_vertex(coords, h);
+    for (size_t i = 0; i < num_in_chunk; ++i) {
+      // A skipped curve is always followed by the failed one in the chunk
+      if (chunk[i].skipped)
+        continue;
+      // The commit may move the points into the incremental store
+      const size_t work = chunk[i].points ? chunk[i].points->size() : 0;
+      rval = commit_curve_facets(chunk[i], vertex_map, curve_warnings);
       if (moab::MB_SUCCESS != rval)
+        return rval;
+      if (!progress.advance(work)) {
+        message << "Export interrupted while faceting curves" << std::endl;
         return moab::MB_FAILURE;
-      verts.push_back(h);
+      }
     }
-    verts.push_back(vertex_map[end_vtx]);
 
-    // Create edges
-    for (size_t i = 0; i < verts.size() - 1; ++i) {
-      moab::EntityHandle h;
-      rval = mdbImpl->create_element(moab::MBEDGE, &verts[i], 2, h);
-      if (moab::MB_SUCCESS != rval)
-        return moab::MB_FAILURE;
-      edges.push_back(h);
+    // The GMem buffers are made again for the next chunk
+    if (tight_memory) {
+      for (size_t i = 0; i < num_in_chunk; ++i)
+        chunk[i].release();
+      chunk_data.clear();
+      chunk_data.resize(chunk_size);
     }
-
-    // If closed, remove duplicate
-    if (verts.front() == verts.back())
-      verts.pop_back();
-    // Add entities to the curve meshset from entitymap
-    rval = mdbImpl->add_entities(ci->second, &verts[0], verts.size());
-    if (moab::MB_SUCCESS != rval)
-      return moab::MB_FAILURE;
-    rval = mdbImpl->add_entities(ci->second, &edges[0], edges.size());
-    if (moab::MB_SUCCESS != rval)
-      return moab::MB_FAILURE;
   }
+  progress.finish();
 
   if (!verbose_warnings && curve_warnings < 0) {
     message << "Suppressed " << -curve_warnings
@@ -730,133 +1957,849 @@ moab::ErrorCode DAGMCExportCommand::create_curve_facets(refentity_handle_map& cu
   return moab::MB_SUCCESS;
 }
 
+void CurveFacets::clear()
+{
+  edge = 0;
+  handle = 0;
+  tolerance.faceting = 0;
+  tolerance.normal = 0;
+  signature = GeometrySignature();
+  cached = 0;
+  status = CUBIT_FAILURE;
+  skipped = false;
+  data = 0;
+  points = 0;
+  point_storage.clear();
+  facet_seconds = 0;
+}
 
-moab::ErrorCode DAGMCExportCommand::create_surface_facets(refentity_handle_map& surface_map,
-                                                          refentity_handle_map& vertex_map)
+void CurveFacets::release()
 {
-  moab::ErrorCode rval;
-  refentity_handle_map_itor ci;
-  CubitStatus s;
-  failed_surface_count =0;
+  clear();
+  std::vector<CubitVector>().swap(point_storage);
+}
 
-  DLIList<TopologyEntity*> me_list;
+void DAGMCExportCommand::facet_curve(CurveFacets& curve)
+{
+  // The points are read in place from wherever the tessellation lives
+  if (curve.cached) {
+    curve.status = CUBIT_SUCCESS;
+    curve.points = &curve.cached->points;
+    return;
+  }
 
-  GMem data;
-  // Create geometry for all surfaces
-  for (ci = surface_map.begin(); ci != surface_map.end(); ++ci) {
-    RefFace* face = dynamic_cast<RefFace*>(ci->first);
+  std::vector<int> no_facets;
+  if (facet_cache.load('c', curve.signature, curve.point_storage, no_facets)) {
+    curve.status = CUBIT_SUCCESS;
+    curve.points = &curve.point_storage;
+    return;
+  }
 
-    data.clear();
-    s = face->get_graphics(data, norm_tol, faceting_tol, len_tol);
+  // Facet curve according to parameters and CGM version
+  curve.data->clear();
+  {
+    std::lock_guard<std::mutex> lock(graphics_mutex);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    curve.status = curve.edge->get_graphics(*curve.data, curve.tolerance.normal,
+                                            curve.tolerance.faceting);
+    curve.facet_seconds = seconds_since(start);
+  }
+  if (CUBIT_SUCCESS != curve.status)
+    return;
 
-    if (CUBIT_SUCCESS != s)
-      return moab::MB_FAILURE;
+  curve.points = &curve.data->point_list();
+  facet_cache.store('c', curve.signature, *curve.points, no_facets);
+}
 
-    std::vector<CubitVector> points = data.point_list();
+moab::ErrorCode DAGMCExportCommand::commit_curve_facets(CurveFacets& curve,
+                                                        refentity_handle_map& vertex_map,
+                                                        int& curve_warnings)
+{
+  moab::ErrorCode rval;
+  RefEdge* edge = curve.edge;
 
-    // Declare array of all vertex handles
-    std::vector<moab::EntityHandle> verts(points.size(), 0);
+  if (CUBIT_SUCCESS != curve.status) {
+    // if we fatal on curves
+    if (fatal_on_curves) {
+      message << "Failed to facet the curve " << edge->id() << std::endl;
+      return moab::MB_FAILURE;
+    }
+    // otherwise record them
+    failed_curve_count++;
+    failed_curves.push_back(edge->id());
+    return moab::MB_SUCCESS;
+  }
 
-    // Get list of geometric vertices in surface
-    me_list.clean_out();
-    ModelQueryEngine::instance()->query_model(*face, DagType::ref_vertex_type(), me_list);
+  // Keep the tessellation for the next incremental export
+  const std::vector<CubitVector>* points = curve.points;
+  if (incremental) {
+    CachedFacets& entry = next_curve_cache[edge->id()];
+    if (curve.cached) {
+      entry = std::move(*curve.cached);
+      curve_cache.erase(edge->id());
+      points = &entry.points;
+      ++reused_curve_count;
+    }
+    else {
+      entry.signature = curve.signature;
+      entry.points = *points;
+    }
+  }
 
-    // For each geometric vertex, find a single coincident point in facets
-    // Otherwise, print a warning
-    for (int i = me_list.size(); i--; ) {
-      // Assign geometric vertex
-      RefVertex* vtx = dynamic_cast<RefVertex*>(me_list.get_and_step());
-      CubitVector pos = vtx->coordinates();
+  if (profile_count > 0) {
+    rval = record_profile(1, edge->id(), curve.handle, curve.facet_seconds,
+                          points->size(), points->size() > 1 ? points->size() - 1 : 0);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+  }
 
-      for (int j = 0; j < points.size(); ++j) {
-        // Assign facet vertex
-        CubitVector vpos = points[j];
+  curve_point_count += points->size();
 
-        // Check to see if they are considered coincident
-        if ((pos - vpos).length_squared() < GEOMETRY_RESABS*GEOMETRY_RESABS) {
-          // If this facet vertex has already been found coincident, print warning
-          if (verts[j]) {
-            message << "Warning: Coincident vertices in surface " << face->id() << std::endl;
-          }
-          // If a coincidence is found, keep track of it in the verts vector
-          verts[j] = vertex_map[vtx];
-          break;
-        }
-      }
-    }
+  // Get the edge's curve information
+  Curve* geom_curve = edge->get_curve_ptr();
 
-    // Now create vertices for the remaining points in the facetting
-    for (int i = 0; i < points.size(); ++i) {
-      if (verts[i]) // If a geometric vertex
-        continue;
-      double coords[] = {points[i].x(), points[i].y(), points[i].z()};
-      // Return vertex handle to verts to fill in all remaining facet
-      // vertices
-      rval = mdbImpl->create_vertex(coords, verts[i]);
-      if (moab::MB_SUCCESS != rval)
-        return rval;
+  // Need to reverse data? Reversed curves are read back to front rather
+  // than reversing a copy of the points
+  const bool reversed = geom_curve->bridge_sense() == CUBIT_REVERSED;
+  const size_t num_points = points->size();
+  auto point = [&](size_t i) -> const CubitVector& {
+    return reversed ? (*points)[num_points - 1 - i] : (*points)[i];
+  };
+  
+  // Check for closed curve
+  RefVertex *start_vtx, *end_vtx;
+  start_vtx = edge->start_vertex();
+  end_vtx = edge->end_vertex();
+
+  moab::EntityHandle start_handle = vertex_map.find(start_vtx);
+  moab::EntityHandle end_handle = vertex_map.find(end_vtx);
+  if (!start_handle || !end_handle) {
+    message << "No vertex for an end of curve " << edge->id() << std::endl;
+    return moab::MB_ENTITY_NOT_FOUND;
+  }
+  
+  // Special case for point curve
+  if (num_points < 2) {
+    if (start_vtx != end_vtx || geom_curve->measure() > GEOMETRY_RESABS) {
+      message << "Warning: No facetting for curve " << edge->id() << std::endl;
+      return moab::MB_SUCCESS;
     }
-
-    std::vector<int> facet_list = data.facet_list();
+    rval = mdbImpl->add_entities(curve.handle, &start_handle, 1);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+    return moab::MB_SUCCESS;
+  }
+  // Check to see if the first and last interior vertices are considered to be
+  // coincident by CUBIT
+  const bool closed = (point(0) - point(num_points - 1)).length() < GEOMETRY_RESABS;
+  if (closed != (start_vtx == end_vtx)) {
+    message << "Warning: topology and geometry inconsistant for possibly closed curve "
+            << edge->id() << std::endl;
+  }
+  
+  // Check proximity of vertices to end coordinates
+  if ((start_vtx->coordinates() - point(0)).length() > GEOMETRY_RESABS ||
+      (end_vtx->coordinates() - point(num_points - 1)).length() > GEOMETRY_RESABS) {
     
-    // record the failures for information
-    if (facet_list.size() == 0)
-      {
-        failed_surface_count++;
-        failed_surfaces.push_back(face->id());
+    curve_warnings--;
+    if (curve_warnings >= 0 || verbose_warnings) {
+      message << "Warning: vertices not at ends of curve " << edge->id() << std::endl;
+      if (curve_warnings == 0 && !verbose_warnings) {
+        message << "         further instances of this warning will be suppressed..." << std::endl;
       }
+    }
+  }
 
-    // Now create facets
-    moab::Range facets;
-    std::vector<moab::EntityHandle> corners;
-    for (int i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
-      // Get number of facet verts
-      int num_verts = facet_list[i];
-      corners.resize(num_verts);
-      for (int j = 1; j <= num_verts; ++j) {
-        if (facet_list[i+j] >= (int)verts.size()) {
-          message << "ERROR: Invalid facet data for surface " << face->id() << std::endl;
-          return moab::MB_FAILURE;
-        }
-        corners[j - 1] = verts[facet_list[i+j]];
-      }
-      moab::EntityType type;
-      if (num_verts == 3)
-        type = moab::MBTRI;
-      else {
-        message << "Warning: non-triangle facet in surface " << face->id() << std::endl;
-        message << "  entity has " << num_verts << " edges" << std::endl;
-        if (num_verts == 4)
-          type = moab::MBQUAD;
-        else
-          type = moab::MBPOLYGON;
-      }
-
-      //if (surf->bridge_sense() == CUBIT_REVERSED)
-        //std::reverse(corners.begin(), corners.end());
-
-      moab::EntityHandle h;
-      rval = mdbImpl->create_element(type, &corners[0], corners.size(), h);
-      if (moab::MB_SUCCESS != rval)
-        return moab::MB_FAILURE;
+  // Compact output leaves out the interior points unless surfaces share
+  // them, and the edges unless make_watertight needs them
+  if (compact && !share_vertices && !make_watertight) {
+    rval = mdbImpl->add_entities(curve.handle, &start_handle, 1);
+    if (moab::MB_SUCCESS == rval && end_handle != start_handle)
+      rval = mdbImpl->add_entities(curve.handle, &end_handle, 1);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+    return moab::MB_SUCCESS;
+  }
 
-      facets.insert(h);
+  // Create interior points in one contiguous block
+  std::vector<moab::EntityHandle>& verts = facet_corners;
+  verts.clear();
+  verts.push_back(start_handle);
+  const int num_interior = num_points - 2;
+  if (num_interior > 0) {
+    moab::EntityHandle start;
+    std::vector<double*> coords;
+    rval = readUtil->get_node_coords(3, num_interior, 0, start, coords);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+    for (int i = 0; i < num_interior; ++i) {
+      const CubitVector& p = point(i + 1);
+      coords[0][i] = p.x();
+      coords[1][i] = p.y();
+      coords[2][i] = p.z();
+      verts.push_back(start + i);
     }
-
-    // Add vertices and facets to surface set
-    rval = mdbImpl->add_entities(ci->second, &verts[0], verts.size());
+  }
+  verts.push_back(end_handle);
+
+  // Create edges in one contiguous block
+  moab::Range edges;
+  if (!compact || make_watertight) {
+    const int num_edges = verts.size() - 1;
+    moab::EntityHandle edge_start, *conn;
+    rval = readUtil->get_element_connect(num_edges, 2, moab::MBEDGE, 0, edge_start, conn);
     if (moab::MB_SUCCESS != rval)
       return moab::MB_FAILURE;
-    rval = mdbImpl->add_entities(ci->second, facets);
+    for (int i = 0; i < num_edges; ++i) {
+      conn[2*i] = verts[i];
+      conn[2*i + 1] = verts[i + 1];
+    }
+    rval = readUtil->update_adjacencies(edge_start, num_edges, 2, conn);
     if (moab::MB_SUCCESS != rval)
       return moab::MB_FAILURE;
+    edges.insert(edge_start, edge_start + num_edges - 1);
+  }
+
+  // Keep the interior vertices for the surfaces bounded by this curve
+  if (share_vertices && num_interior > 0) {
+    CurveVertices& shared = curve_vertices[edge];
+    shared.points.resize(num_interior);
+    for (int i = 0; i < num_interior; ++i)
+      shared.points[i] = point(i + 1);
+    shared.handles.assign(verts.begin() + 1, verts.begin() + 1 + num_interior);
   }
 
+  // If closed, remove duplicate
+  if (verts.front() == verts.back())
+    verts.pop_back();
+  // Add entities to the curve meshset from entitymap
+  rval = mdbImpl->add_entities(curve.handle, &verts[0], verts.size());
+  if (moab::MB_SUCCESS != rval)
+    return moab::MB_FAILURE;
+  rval = mdbImpl->add_entities(curve.handle, edges);
+  if (moab::MB_SUCCESS != rval)
+    return moab::MB_FAILURE;
+
   return moab::MB_SUCCESS;
 }
 
-moab::ErrorCode DAGMCExportCommand::gather_ents(moab::EntityHandle gather_set)
-{
+moab::ErrorCode DAGMCExportCommand::create_surface_facets(refentity_handle_map& surface_map,
+                                                          refentity_handle_map& vertex_map)
+{
+  moab::ErrorCode rval;
+  refentity_handle_map_itor ci;
+  size_t vertex_comparisons = 0;
+
+  DLIList<TopologyEntity*> me_list;
+
+  // Surfaces are processed in chunks. Within a chunk the cache lookups and
+  // vertex matching run concurrently, with the CGM tessellation itself
+  // serialized by facet_surface, but MOAB entities are always created
+  // serially in surface_map order so the output does not depend on the number
+  // of threads.
+  // The chunk entries and their GMem buffers are reused from chunk to chunk
+  // so that their storage is only reallocated when a surface needs more.
+  // tight_memory only keeps one tessellation per thread at a time
+  const size_t chunk_size = num_threads > 1 && !tight_memory ? 16 * (size_t)num_threads : num_threads;
+  progress.start("Faceting surfaces", surface_map.size(),
+                 census.surfaces ? census.surface_facets * surface_map.size() / census.surfaces : 0);
+  std::vector<SurfaceFacets> chunk(chunk_size);
+  std::vector<GMem> chunk_data(chunk_size);
+  size_t num_in_chunk;
+
+  ci = surface_map.begin();
+  while (ci != surface_map.end()) {
+    for (num_in_chunk = 0; ci != surface_map.end() && num_in_chunk < chunk_size; ++ci) {
+      SurfaceFacets& surf = chunk[num_in_chunk];
+      surf.clear();
+      surf.data = &chunk_data[num_in_chunk++];
+      surf.face = dynamic_cast<RefFace*>(ci->first);
+      surf.handle = ci->second;
+
+      surf.tolerance = tolerance_of(surf.face);
+
+      // Reuse the previous tessellation if the surface has not changed
+      if (incremental || facet_cache.enabled()) {
+        surf.signature = GeometrySignature::of_surface(surf.face);
+        if (entity_tolerances.count(surf.face))
+          surf.signature.add_tolerance(surf.tolerance.faceting, surf.tolerance.normal);
+      }
+      if (incremental) {
+        std::map<int, CachedFacets>::iterator cached = surface_cache.find(surf.face->id());
+        if (cached != surface_cache.end() && cached->second.signature == surf.signature)
+          surf.cached = &cached->second;
+      }
+
+      // Get list of geometric vertices in surface; the model query engine is
+      // not reentrant so this is done before any tessellation is started
+      me_list.clean_out();
+      ModelQueryEngine::instance()->query_model(*surf.face, DagType::ref_vertex_type(), me_list);
+      for (int i = me_list.size(); i--; ) {
+        RefVertex* vtx = dynamic_cast<RefVertex*>(me_list.get_and_step());
+        moab::EntityHandle vh = vertex_map.find(vtx);
+        if (!vh) {
+          message << "No vertex for vertex " << vtx->id() << " of surface " << surf.face->id() << std::endl;
+          return moab::MB_ENTITY_NOT_FOUND;
+        }
+        surf.vertices.push_back(vtx);
+        surf.vertex_handles.push_back(vh);
+      }
+
+      // Get the already faceted curves bounding the surface
+      if (share_vertices) {
+        me_list.clean_out();
+        ModelQueryEngine::instance()->query_model(*surf.face, DagType::ref_edge_type(), me_list);
+        for (int i = me_list.size(); i--; ) {
+          RefEntity* edge = dynamic_cast<RefEntity*>(me_list.get_and_step());
+          std::map<RefEntity*, CurveVertices>::const_iterator cv = curve_vertices.find(edge);
+          if (cv != curve_vertices.end())
+            surf.curves.push_back(&cv->second);
+        }
+      }
+    }
+
+    parallel_for(num_in_chunk, num_threads,
+                 [&](size_t i) { facet_surface(chunk[i]); },
+                 [&]() { return progress.check_interrupt(); });
+    if (progress.cancelled()) {
+      message << "Export interrupted while faceting surfaces" << std::endl;
+      return moab::MB_FAILURE;
+    }
+
+    for (size_t i = 0; i < num_in_chunk; ++i) {
+      SurfaceFacets& surf = chunk[i];
+      // Nearly all facets are triangles, which take four entries; they are
+      // counted before the facets may move into the incremental store
+      const size_t work = surf.mesh_facet_list ? surf.mesh_facet_list->size() / 4 : 0;
+      rval = commit_surface_facets(surf);
+      if (moab::MB_SUCCESS != rval)
+        return rval;
+
+      // Keep the tessellation for the next incremental export
+      if (incremental) {
+        int id = surf.face->id();
+        CachedFacets& entry = next_surface_cache[id];
+        if (surf.cached) {
+          entry = std::move(*surf.cached);
+          surface_cache.erase(id);
+          ++reused_surface_count;
+        }
+        else {
+          // Tessellations read from the disk cache already have their own
+          // storage; those from CGM are copied out of the reused GMem
+          entry.signature = surf.signature;
+          if (surf.points == &surf.point_storage) {
+            entry.points.swap(surf.point_storage);
+            entry.facet_list.swap(surf.facet_storage);
+          }
+          else {
+            entry.points = *surf.points;
+            entry.facet_list = *surf.facet_list;
+          }
+        }
+      }
+
+      vertex_comparisons += chunk[i].vertex_comparisons;
+      unsealed_point_count += chunk[i].unsealed_points;
+      removed_triangle_count += chunk[i].removed_triangles;
+
+      if (!progress.advance(work)) {
+        message << "Export interrupted while faceting surfaces" << std::endl;
+        return moab::MB_FAILURE;
+      }
+    }
+
+    // The GMem buffers are made again for the next chunk
+    if (tight_memory) {
+      for (size_t i = 0; i < num_in_chunk; ++i)
+        chunk[i].release();
+      chunk_data.clear();
+      chunk_data.resize(chunk_size);
+    }
+  }
+
+  progress.finish();
+
+  if (verbose_warnings)
+    message << "Made " << vertex_comparisons
+            << " candidate comparisons matching vertices to surface facet points" << std::endl;
+
+  return moab::MB_SUCCESS;
+}
+
+void DAGMCExportCommand::take_census(refentity_handle_map& curve_map,
+                                     refentity_handle_map& surface_map)
+{
+  census.curves = curve_map.size();
+  census.surfaces = surface_map.size();
+  census.curve_points = census.surface_points = census.surface_facets = 0;
+  census.max_points = 0;
+  census.known = 0;
+
+  // The previous tessellations of the incremental store give the sizes of
+  // most entities exactly, even if the entity has since changed
+  refentity_handle_map_itor ci;
+  for (ci = curve_map.begin(); ci != curve_map.end(); ++ci) {
+    std::map<int, CachedFacets>::const_iterator cached = curve_cache.find(ci->first->id());
+    size_t num_points = (size_t)points_per_curve;
+    if (cached != curve_cache.end()) {
+      num_points = cached->second.points.size();
+      ++census.known;
+    }
+    census.curve_points += num_points;
+    census.max_points = std::max(census.max_points, num_points);
+  }
+  for (ci = surface_map.begin(); ci != surface_map.end(); ++ci) {
+    std::map<int, CachedFacets>::const_iterator cached = surface_cache.find(ci->first->id());
+    size_t num_points = (size_t)points_per_surface;
+    if (cached != surface_cache.end()) {
+      // Nearly all facets are triangles, which take four entries
+      num_points = cached->second.points.size();
+      census.surface_facets += cached->second.facet_list.size() / 4;
+      ++census.known;
+    }
+    else {
+      census.surface_facets += (size_t)facets_per_surface;
+    }
+    census.surface_points += num_points;
+    census.max_points = std::max(census.max_points, num_points);
+  }
+
+  if (verbose_warnings)
+    message << "Expecting about " << census.curve_points + census.surface_points
+            << " points and " << census.surface_facets << " surface facets ("
+            << census.known << " of " << census.curves + census.surfaces
+            << " entities known from the previous export)" << std::endl;
+
+  // The scratch buffers are reused for every entity, and the profile holds
+  // one entry for each
+  facet_corners.reserve(census.max_points + 1);
+  if (profile_count > 0)
+    profiles.reserve(census.curves + census.surfaces);
+}
+
+void DAGMCExportCommand::start_faceting()
+{
+  failed_curve_count = 0;
+  failed_curves.clear();
+  failed_surface_count = 0;
+  failed_surfaces.clear();
+  unsealed_point_count = 0;
+  removed_triangle_count = 0;
+  curve_point_count = surface_point_count = surface_facet_count = 0;
+  profiles.clear();
+  reused_curve_count = 0;
+  reused_surface_count = 0;
+  next_curve_cache.clear();
+  next_surface_cache.clear();
+}
+
+void DAGMCExportCommand::finish_faceting(size_t num_curves, size_t num_surfaces)
+{
+  // Keep the tessellations of this export for the next incremental one
+  curve_cache.swap(next_curve_cache);
+  surface_cache.swap(next_surface_cache);
+  next_curve_cache.clear();
+  next_surface_cache.clear();
+  if (incremental)
+    message << "Reused the previous faceting of " << reused_curve_count << " of "
+            << num_curves << " curves and " << reused_surface_count << " of "
+            << num_surfaces << " surfaces" << std::endl;
+
+  if (share_vertices)
+    message << "Found " << unsealed_point_count
+            << " surface boundary points not shared with a curve" << std::endl;
+
+  if (decimate)
+    message << "Removed " << removed_triangle_count
+            << " coplanar surface triangles" << std::endl;
+
+  // Measured sizes for the census of the next export
+  if (num_curves > 0)
+    points_per_curve = (double)curve_point_count / num_curves;
+  if (num_surfaces > 0) {
+    points_per_surface = (double)surface_point_count / num_surfaces;
+    facets_per_surface = (double)surface_facet_count / num_surfaces;
+  }
+  if (verbose_warnings)
+    message << "Made " << curve_point_count + surface_point_count << " points and "
+            << surface_facet_count << " surface facets" << std::endl;
+}
+
+void SurfaceFacets::clear()
+{
+  face = 0;
+  handle = 0;
+  tolerance.faceting = 0;
+  tolerance.normal = 0;
+  signature = GeometrySignature();
+  cached = 0;
+  vertices.clear();
+  vertex_handles.clear();
+  curves.clear();
+  status = CUBIT_FAILURE;
+  data = 0;
+  points = 0;
+  facet_list = 0;
+  point_storage.clear();
+  facet_storage.clear();
+  mesh_points = 0;
+  mesh_facet_list = 0;
+  mesh_point_storage.clear();
+  mesh_facet_storage.clear();
+  removed_triangles = 0;
+  point_handles.clear();
+  vertex_comparisons = 0;
+  unsealed_points = 0;
+  facet_seconds = 0;
+  warnings.clear();
+}
+
+void SurfaceFacets::release()
+{
+  clear();
+  std::vector<RefVertex*>().swap(vertices);
+  std::vector<moab::EntityHandle>().swap(vertex_handles);
+  std::vector<const CurveVertices*>().swap(curves);
+  std::vector<CubitVector>().swap(point_storage);
+  std::vector<int>().swap(facet_storage);
+  std::vector<CubitVector>().swap(mesh_point_storage);
+  std::vector<int>().swap(mesh_facet_storage);
+  std::vector<moab::EntityHandle>().swap(point_handles);
+  std::string().swap(warnings);
+}
+
+void DAGMCExportCommand::facet_surface(SurfaceFacets& surf)
+{
+  // The points and facets are read in place from wherever the tessellation
+  // lives rather than copied
+  if (surf.cached) {
+    surf.status = CUBIT_SUCCESS;
+    surf.points = &surf.cached->points;
+    surf.facet_list = &surf.cached->facet_list;
+  }
+  else if (facet_cache.load('s', surf.signature, surf.point_storage, surf.facet_storage)) {
+    surf.status = CUBIT_SUCCESS;
+    surf.points = &surf.point_storage;
+    surf.facet_list = &surf.facet_storage;
+  }
+  else {
+    surf.data->clear();
+    {
+      std::lock_guard<std::mutex> lock(graphics_mutex);
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      surf.status = surf.face->get_graphics(*surf.data, surf.tolerance.normal,
+                                            surf.tolerance.faceting, len_tol);
+      surf.facet_seconds = seconds_since(start);
+    }
+    if (CUBIT_SUCCESS != surf.status)
+      return;
+
+    surf.points = &surf.data->point_list();
+    surf.facet_list = &surf.data->facet_list();
+    facet_cache.store('s', surf.signature, *surf.points, *surf.facet_list);
+  }
+
+  const std::vector<CubitVector>& points = *surf.points;
+  const std::vector<int>& facet_list = *surf.facet_list;
+
+  // For each geometric vertex, find a single coincident point in facets
+  // Otherwise, print a warning
+  PointGrid grid(GEOMETRY_RESABS);
+  grid.build(points);
+  surf.point_handles.assign(points.size(), 0);
+  for (size_t i = 0; i < surf.vertices.size(); ++i) {
+    int j = grid.find(surf.vertices[i]->coordinates());
+    if (j < 0)
+      continue;
+    // If this facet vertex has already been found coincident, print warning
+    if (surf.point_handles[j]) {
+      std::ostringstream warning;
+      warning << "Warning: Coincident vertices in surface " << surf.face->id() << std::endl;
+      surf.warnings += warning.str();
+    }
+    // If a coincidence is found, keep track of it
+    surf.point_handles[j] = surf.vertex_handles[i];
+  }
+
+  if (share_vertices) {
+    // Reuse the interior vertices of the bounding curves in the same way
+    for (size_t c = 0; c < surf.curves.size(); ++c) {
+      const CurveVertices& curve = *surf.curves[c];
+      for (size_t i = 0; i < curve.points.size(); ++i) {
+        int j = grid.find(curve.points[i]);
+        if (j < 0)
+          continue;
+        if (surf.point_handles[j]) {
+          std::ostringstream warning;
+          warning << "Warning: Coincident curve vertices in surface " << surf.face->id() << std::endl;
+          surf.warnings += warning.str();
+        }
+        surf.point_handles[j] = curve.handles[i];
+      }
+    }
+
+    // Count the points on the facet boundary that did not land on a curve
+    // vertex; if there are none the surface is sealed to its curves.
+    // Invalid facet data is not scanned and is reported when the surface is
+    // committed.
+    std::vector<std::pair<int, int> > facet_edges;
+    const bool valid = valid_facet_list(facet_list, points.size());
+    for (size_t i = 0; valid && i < facet_list.size(); i += facet_list[i] + 1) {
+      int num_verts = facet_list[i];
+      for (int j = 0; j < num_verts; ++j) {
+        int a = facet_list[i + 1 + j];
+        int b = facet_list[i + 1 + (j + 1) % num_verts];
+        facet_edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+      }
+    }
+    std::sort(facet_edges.begin(), facet_edges.end());
+
+    std::vector<bool> on_boundary(points.size(), false);
+    for (size_t i = 0; i < facet_edges.size(); ) {
+      size_t j = i + 1;
+      while (j < facet_edges.size() && facet_edges[j] == facet_edges[i])
+        ++j;
+      // Edges used by a single facet are on the boundary
+      if (j - i == 1) {
+        on_boundary[facet_edges[i].first] = true;
+        on_boundary[facet_edges[i].second] = true;
+      }
+      i = j;
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (on_boundary[i] && !surf.point_handles[i])
+        ++surf.unsealed_points;
+    }
+  }
+
+  surf.vertex_comparisons = grid.comparisons();
+
+  surf.mesh_points = surf.points;
+  surf.mesh_facet_list = surf.facet_list;
+  // Invalid facet data is left for the commit to report
+  if (!(decimate || reorder) || !valid_facet_list(facet_list, points.size()))
+    return;
+
+  if (decimate) {
+    // Points shared with the geometric vertices and curves stay in place
+    std::vector<bool> fixed(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+      fixed[i] = surf.point_handles[i] != 0;
+    std::vector<int> kept_points;
+    FacetDecimator decimator(decimation_angle, decimation_distance);
+    surf.removed_triangles = decimator.decimate(points, facet_list, fixed, surf.mesh_point_storage,
+                                                surf.mesh_facet_storage, kept_points);
+    if (surf.removed_triangles > 0) {
+      for (size_t i = 0; i < kept_points.size(); ++i)
+        surf.point_handles[i] = surf.point_handles[kept_points[i]];
+      surf.point_handles.resize(kept_points.size());
+      surf.mesh_points = &surf.mesh_point_storage;
+      surf.mesh_facet_list = &surf.mesh_facet_storage;
+
+      if (verbose_warnings) {
+        std::ostringstream note;
+        note << "Removed " << surf.removed_triangles << " coplanar triangles from surface "
+             << surf.face->id() << std::endl;
+        surf.warnings += note.str();
+      }
+    }
+  }
+
+  if (reorder)
+    reorder_facets(surf);
+}
+
+void DAGMCExportCommand::reorder_facets(SurfaceFacets& surf)
+{
+  const std::vector<CubitVector>& points = *surf.mesh_points;
+  const std::vector<int>& facet_list = *surf.mesh_facet_list;
+
+  // Points along a Morton curve, so the new vertices are created in that order
+  std::vector<int> order;
+  morton_order(points, order);
+  std::vector<int> new_index(points.size());
+  std::vector<CubitVector> new_points(points.size());
+  std::vector<moab::EntityHandle> new_handles(points.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    new_index[order[i]] = i;
+    new_points[i] = points[order[i]];
+    new_handles[i] = surf.point_handles[order[i]];
+  }
+
+  // Facets along a Morton curve through their centroids
+  std::vector<size_t> offsets;
+  std::vector<CubitVector> centroids;
+  for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+    CubitVector sum(0, 0, 0);
+    for (int j = 1; j <= facet_list[i]; ++j)
+      sum += points[facet_list[i + j]];
+    offsets.push_back(i);
+    centroids.push_back(facet_list[i] > 0 ? sum / facet_list[i] : sum);
+  }
+  morton_order(centroids, order);
+  std::vector<int> new_facets;
+  new_facets.reserve(facet_list.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    size_t offset = offsets[order[i]];
+    new_facets.push_back(facet_list[offset]);
+    for (int j = 1; j <= facet_list[offset]; ++j)
+      new_facets.push_back(new_index[facet_list[offset + j]]);
+  }
+
+  surf.mesh_point_storage.swap(new_points);
+  surf.mesh_facet_storage.swap(new_facets);
+  surf.point_handles.swap(new_handles);
+  surf.mesh_points = &surf.mesh_point_storage;
+  surf.mesh_facet_list = &surf.mesh_facet_storage;
+}
+
+moab::ErrorCode DAGMCExportCommand::commit_surface_facets(SurfaceFacets& surf)
+{
+  moab::ErrorCode rval;
+  RefFace* face = surf.face;
+
+  message << surf.warnings;
+
+  if (CUBIT_SUCCESS != surf.status)
+    return moab::MB_FAILURE;
+
+  const std::vector<CubitVector>& points = *surf.mesh_points;
+
+  // Record the tolerances of surfaces that do not use the global ones
+  if (!entity_tolerances.empty()) {
+    rval = mdbImpl->tag_set_data(surface_faceting_tol_tag, &surf.handle, 1, &surf.tolerance.faceting);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+    rval = mdbImpl->tag_set_data(surface_normal_tol_tag, &surf.handle, 1, &surf.tolerance.normal);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+  }
+
+  if (profile_count > 0) {
+    size_t num_facets = 0;
+    for (size_t i = 0; i < surf.mesh_facet_list->size(); i += (*surf.mesh_facet_list)[i] + 1)
+      ++num_facets;
+    rval = record_profile(2, face->id(), surf.handle, surf.facet_seconds,
+                          points.size(), num_facets);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+  }
+
+  // Declare array of all vertex handles, starting from the existing
+  // vertices that are coincident with facet points
+  std::vector<moab::EntityHandle>& verts = surf.point_handles;
+
+  const std::vector<int>& facet_list = *surf.mesh_facet_list;
+
+  // record the failures for information
+  if (facet_list.size() == 0)
+    {
+      failed_surface_count++;
+      failed_surfaces.push_back(face->id());
+    }
+
+  // Count the new vertices and the triangles up front so that both can be
+  // allocated in contiguous blocks
+  int num_new_verts = 0;
+  for (size_t i = 0; i < verts.size(); ++i) {
+    if (!verts[i])
+      ++num_new_verts;
+  }
+
+  // Every facet must be complete and refer to existing points
+  if (!valid_facet_list(facet_list, verts.size())) {
+    message << "ERROR: Invalid facet data for surface " << face->id() << std::endl;
+    return moab::MB_FAILURE;
+  }
+  int num_tris = 0;
+  for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+    int num_verts = facet_list[i];
+    if (num_verts == 3)
+      ++num_tris;
+    ++surface_facet_count;
+  }
+  surface_point_count += points.size();
+
+  // Now create vertices for the remaining points in the facetting
+  if (num_new_verts > 0) {
+    moab::EntityHandle start;
+    std::vector<double*> coords;
+    rval = readUtil->get_node_coords(3, num_new_verts, 0, start, coords);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+    int n = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (verts[i]) // If a geometric vertex
+        continue;
+      coords[0][n] = points[i].x();
+      coords[1][n] = points[i].y();
+      coords[2][n] = points[i].z();
+      // Return vertex handle to verts to fill in all remaining facet
+      // vertices
+      verts[i] = start + n++;
+    }
+  }
+
+  // Now create facets, triangles first in a single block
+  moab::Range facets;
+  if (num_tris > 0) {
+    moab::EntityHandle start, *conn;
+    rval = readUtil->get_element_connect(num_tris, 3, moab::MBTRI, 0, start, conn);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+    moab::EntityHandle* corners = conn;
+    for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+      if (facet_list[i] != 3)
+        continue;
+      for (int j = 1; j <= 3; ++j)
+        *corners++ = verts[facet_list[i+j]];
+    }
+    rval = readUtil->update_adjacencies(start, num_tris, 3, conn);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+    facets.insert(start, start + num_tris - 1);
+  }
+
+  // Any other facets are rare and are created one at a time
+  std::vector<moab::EntityHandle>& corners = facet_corners;
+  for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+    // Get number of facet verts
+    int num_verts = facet_list[i];
+    if (num_verts == 3)
+      continue;
+    corners.resize(num_verts);
+    for (int j = 1; j <= num_verts; ++j)
+      corners[j - 1] = verts[facet_list[i+j]];
+
+    message << "Warning: non-triangle facet in surface " << face->id() << std::endl;
+    message << "  entity has " << num_verts << " edges" << std::endl;
+    moab::EntityType type = num_verts == 4 ? moab::MBQUAD : moab::MBPOLYGON;
+
+    //if (surf->bridge_sense() == CUBIT_REVERSED)
+      //std::reverse(corners.begin(), corners.end());
+
+    moab::EntityHandle h;
+    rval = mdbImpl->create_element(type, &corners[0], corners.size(), h);
+    if (moab::MB_SUCCESS != rval)
+      return moab::MB_FAILURE;
+
+    facets.insert(h);
+  }
+
+  // Add vertices and facets to surface set
+  rval = mdbImpl->add_entities(surf.handle, &verts[0], verts.size());
+  if (moab::MB_SUCCESS != rval)
+    return moab::MB_FAILURE;
+  rval = mdbImpl->add_entities(surf.handle, facets);
+  if (moab::MB_SUCCESS != rval)
+    return moab::MB_FAILURE;
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::gather_ents(moab::EntityHandle gather_set)
+{
   moab::ErrorCode rval;
   moab::Range new_ents;
   rval = mdbImpl->get_entities_by_handle(0,new_ents);
@@ -877,3 +2820,645 @@ moab::ErrorCode DAGMCExportCommand::gather_ents(moab::EntityHandle gather_set)
   return rval;
 }
 
+moab::ErrorCode DAGMCExportCommand::export_batches(refentity_handle_map (&entmap)[5],
+                                                   const std::string& filename)
+{
+  moab::ErrorCode rval;
+  refentity_handle_map_itor ci;
+  refentity_handle_map& vertex_map = vertex_handles;
+  refentity_handle_map& curve_map = entmap[1];
+  refentity_handle_map& surface_map = entmap[2];
+  refentity_handle_map& volume_map = entmap[3];
+
+  // Batch of every volume set, in volume_map order
+  std::map<moab::EntityHandle, int> volume_batch;
+  int num_volumes = 0;
+  for (ci = volume_map.begin(); ci != volume_map.end(); ++ci)
+    volume_batch[ci->second] = num_volumes++ / batch_size;
+  const int num_batches = std::max(1, (num_volumes + batch_size - 1) / batch_size);
+
+  std::string index_name = index_file_name(filename, ".batches");
+  std::ofstream index(index_name.c_str());
+  if (!index) {
+    message << "Could not open batch index " << index_name << std::endl;
+    return moab::MB_FAILURE;
+  }
+
+  // Every surface and curve is faceted with the first batch that needs it
+  // and kept until no later batch does
+  refentity_handle_map faceted_curves, faceted_surfaces;
+  std::vector<std::pair<RefEntity*, moab::EntityHandle> > live_curves, live_surfaces;
+  std::set<moab::EntityHandle> released_surfaces;
+  refentity_handle_map batch_curves, batch_surfaces;
+  std::vector<moab::EntityHandle> output_sets, parents;
+  DLIList<RefFace*> faces;
+  DLIList<RefEdge*> edges;
+
+  if (build_obb) {
+    rval = myGeomTool->find_geomsets();
+    CHK_MB_ERR_RET_MB("Error finding geometry sets: ", rval);
+  }
+
+  // Queue a surface and those of its curves that are not yet faceted
+  auto add_surface = [&](RefEntity* face, moab::EntityHandle h) {
+    if (!faceted_surfaces.insert(face, h))
+      return;
+    batch_surfaces.insert(face, h);
+    live_surfaces.push_back(std::make_pair(face, h));
+    edges.clean_out();
+    dynamic_cast<RefFace*>(face)->ref_edges(edges);
+    for (int i = edges.size(); i--; ) {
+      RefEdge* edge = edges.get_and_step();
+      moab::EntityHandle eh = curve_map.find(edge);
+      if (eh && faceted_curves.insert(edge, eh)) {
+        batch_curves.insert(edge, eh);
+        live_curves.push_back(std::make_pair(edge, eh));
+      }
+    }
+  };
+
+  ci = volume_map.begin();
+  for (int batch = 0; batch < num_batches; ++batch) {
+    const bool last = batch + 1 == num_batches;
+    std::ostringstream phase;
+    phase << "facet_batch_" << batch;
+    timer.start(phase.str());
+
+    batch_curves.clear();
+    batch_surfaces.clear();
+    output_sets.clear();
+    std::string batch_name = part_file_name(filename, "batch", batch);
+    index << batch_name;
+    for (int i = 0; i < batch_size && ci != volume_map.end(); ++i, ++ci) {
+      output_sets.push_back(ci->second);
+      index << " " << ci->first->id();
+      faces.clean_out();
+      dynamic_cast<RefVolume*>(ci->first)->ref_faces(faces);
+      for (int j = faces.size(); j--; ) {
+        RefFace* face = faces.get_and_step();
+        moab::EntityHandle h = surface_map.find(face);
+        if (h)
+          add_surface(face, h);
+      }
+    }
+    index << std::endl;
+
+    // Surfaces and curves that do not bound any volume go with the last batch
+    if (last) {
+      for (refentity_handle_map_itor si = surface_map.begin(); si != surface_map.end(); ++si) {
+        if (!faceted_surfaces.contains(si->first)) {
+          add_surface(si->first, si->second);
+          output_sets.push_back(si->second);
+        }
+      }
+      for (refentity_handle_map_itor ei = curve_map.begin(); ei != curve_map.end(); ++ei) {
+        if (faceted_curves.insert(ei->first, ei->second)) {
+          batch_curves.insert(ei->first, ei->second);
+          output_sets.push_back(ei->second);
+        }
+      }
+    }
+
+    rval = create_curve_facets(batch_curves, vertex_map);
+    CHK_MB_ERR_RET_MB("Error faceting curves: ", rval);
+    rval = create_surface_facets(batch_surfaces, vertex_map);
+    CHK_MB_ERR_RET_MB("Error faceting surfaces: ", rval);
+
+    // Trees are built for every surface and volume in the batch, including
+    // surfaces faceted for an earlier batch, and deleted once written
+    if (build_obb) {
+      phase.str("");
+      phase << "build_obb_batch_" << batch;
+      timer.start(phase.str());
+      moab::Range closure;
+      for (size_t i = 0; i < output_sets.size(); ++i) {
+        closure.insert(output_sets[i]);
+        rval = mdbImpl->get_child_meshsets(output_sets[i], closure, 0);
+        CHK_MB_ERR_RET_MB("Error getting batch closure: ", rval);
+      }
+      for (int dim = 2; dim < 4; ++dim) {
+        for (moab::Range::iterator si = closure.begin(); si != closure.end(); ++si) {
+          moab::EntityHandle set = *si;
+          int set_dim;
+          rval = mdbImpl->tag_get_data(geom_tag, &set, 1, &set_dim);
+          CHK_MB_ERR_RET_MB("Error getting set dimension: ", rval);
+          if (set_dim != dim)
+            continue;
+          rval = myGeomTool->construct_obb_tree(set);
+          CHK_MB_ERR_RET_MB("Error building OBB tree: ", rval);
+        }
+      }
+    }
+
+    phase.str("");
+    phase << "write_batch_" << batch;
+    timer.start(phase.str());
+    if (element_ids) {
+      rval = assign_element_ids();
+      CHK_MB_ERR_RET_MB("Error assigning element ids: ", rval);
+    }
+    rval = write_part(batch_name, output_sets, entmap[4]);
+    CHK_MB_ERR_RET_MB("Error writing batch file: ", rval);
+    message << "Wrote batch " << batch << " to " << batch_name << std::endl;
+
+    if (build_obb) {
+      rval = myGeomTool->delete_all_obb_trees();
+      CHK_MB_ERR_RET_MB("Error deleting OBB trees: ", rval);
+    }
+
+    if (last)
+      break;
+
+    // Free the facets of every surface whose volumes have all been written,
+    // then those of every curve whose surfaces have all been freed
+    size_t kept = 0;
+    for (size_t i = 0; i < live_surfaces.size(); ++i) {
+      parents.clear();
+      rval = mdbImpl->get_parent_meshsets(live_surfaces[i].second, parents);
+      CHK_MB_ERR_RET_MB("Error getting surface volumes: ", rval);
+      bool done = true;
+      for (size_t j = 0; j < parents.size() && done; ++j) {
+        std::map<moab::EntityHandle, int>::const_iterator vb = volume_batch.find(parents[j]);
+        done = vb == volume_batch.end() || vb->second <= batch;
+      }
+      if (!done) {
+        live_surfaces[kept++] = live_surfaces[i];
+        continue;
+      }
+      rval = release_facets(live_surfaces[i].second, 2);
+      CHK_MB_ERR_RET_MB("Error freeing surface facets: ", rval);
+      released_surfaces.insert(live_surfaces[i].second);
+    }
+    live_surfaces.resize(kept);
+
+    kept = 0;
+    for (size_t i = 0; i < live_curves.size(); ++i) {
+      parents.clear();
+      rval = mdbImpl->get_parent_meshsets(live_curves[i].second, parents);
+      CHK_MB_ERR_RET_MB("Error getting curve surfaces: ", rval);
+      bool done = true;
+      for (size_t j = 0; j < parents.size() && done; ++j)
+        done = released_surfaces.count(parents[j]) > 0;
+      if (!done) {
+        live_curves[kept++] = live_curves[i];
+        continue;
+      }
+      rval = release_facets(live_curves[i].second, 1);
+      CHK_MB_ERR_RET_MB("Error freeing curve facets: ", rval);
+      curve_vertices.erase(live_curves[i].first);
+    }
+    live_curves.resize(kept);
+  }
+
+  message << "Wrote " << num_batches << " batch file(s) listed in " << index_name << std::endl;
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::write_shards(refentity_handle_map (&entmap)[5],
+                                                 const std::string& filename)
+{
+  moab::ErrorCode rval;
+  refentity_handle_map& volume_map = entmap[3];
+
+  std::string index_name = index_file_name(filename, ".shards");
+  std::ofstream index(index_name.c_str());
+  if (!index) {
+    message << "Could not open shard index " << index_name << std::endl;
+    return moab::MB_FAILURE;
+  }
+
+  // Shard k holds volumes [k*V/n, (k+1)*V/n) in volume_map order. The MOAB
+  // instance is not safe for concurrent use, so the shards are written one
+  // after another.
+  const int num_volumes = volume_map.size();
+  const int n = std::max(1, std::min(num_shards, num_volumes));
+  std::vector<moab::EntityHandle> output_sets;
+  refentity_handle_map_itor ci = volume_map.begin();
+  for (int shard = 0; shard < n; ++shard) {
+    std::string shard_name = part_file_name(filename, "shard", shard);
+    index << shard_name;
+    output_sets.clear();
+    const int end = (int)(((long)(shard + 1) * num_volumes) / n);
+    for (int v = (int)(((long)shard * num_volumes) / n); v < end; ++v, ++ci) {
+      output_sets.push_back(ci->second);
+      index << " " << ci->first->id();
+    }
+    index << std::endl;
+
+    // Surfaces and curves that do not bound any volume go with the last shard
+    if (shard + 1 == n) {
+      for (int dim = 1; dim < 3; ++dim) {
+        for (refentity_handle_map_itor ei = entmap[dim].begin(); ei != entmap[dim].end(); ++ei) {
+          std::vector<moab::EntityHandle> parents;
+          rval = mdbImpl->get_parent_meshsets(ei->second, parents);
+          CHK_MB_ERR_RET_MB("Error getting parent sets: ", rval);
+          if (parents.empty())
+            output_sets.push_back(ei->second);
+        }
+      }
+    }
+
+    rval = write_part(shard_name, output_sets, entmap[4]);
+    CHK_MB_ERR_RET_MB("Error writing shard file: ", rval);
+  }
+
+  message << "Wrote " << n << " shard file(s) listed in " << index_name << std::endl;
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::write_part(const std::string& filename,
+                                               const std::vector<moab::EntityHandle>& output_sets,
+                                               refentity_handle_map& group_map)
+{
+  moab::ErrorCode rval;
+
+  // The writer adds the child sets of the output sets itself
+  moab::Range closure;
+  for (size_t i = 0; i < output_sets.size(); ++i) {
+    closure.insert(output_sets[i]);
+    rval = mdbImpl->get_child_meshsets(output_sets[i], closure, 0);
+    CHK_MB_ERR_RET_MB("Error getting part closure: ", rval);
+  }
+
+  // Groups would pull the rest of the model into the file, so each is
+  // written as a copy holding only its members in this part
+  std::vector<moab::EntityHandle> sets(output_sets), subsets;
+  std::vector<moab::Tag> name_tags(1, name_tag);
+  name_tags.insert(name_tags.end(), extra_name_tags.begin(), extra_name_tags.end());
+  for (refentity_handle_map_itor ci = group_map.begin(); ci != group_map.end(); ++ci) {
+    moab::Range members;
+    rval = mdbImpl->get_entities_by_type(ci->second, moab::MBENTITYSET, members);
+    CHK_MB_ERR_RET_MB("Error getting group members: ", rval);
+    members = moab::intersect(members, closure);
+    if (members.empty())
+      continue;
+
+    moab::EntityHandle h;
+    rval = mdbImpl->create_meshset(moab::MESHSET_SET, h);
+    CHK_MB_ERR_RET_MB("Error creating partial group: ", rval);
+    subsets.push_back(h);
+    rval = mdbImpl->add_entities(h, members);
+    CHK_MB_ERR_RET_MB("Error filling partial group: ", rval);
+
+    char namebuf[NAME_TAG_SIZE];
+    for (size_t i = 0; i < name_tags.size(); ++i) {
+      rval = mdbImpl->tag_get_data(name_tags[i], &ci->second, 1, namebuf);
+      if (moab::MB_TAG_NOT_FOUND == rval)
+        continue;
+      CHK_MB_ERR_RET_MB("Error getting group name: ", rval);
+      rval = mdbImpl->tag_set_data(name_tags[i], &h, 1, namebuf);
+      CHK_MB_ERR_RET_MB("Error setting group name: ", rval);
+    }
+    int id;
+    rval = mdbImpl->tag_get_data(id_tag, &ci->second, 1, &id);
+    CHK_MB_ERR_RET_MB("Error getting group id: ", rval);
+    rval = mdbImpl->tag_set_data(id_tag, &h, 1, &id);
+    CHK_MB_ERR_RET_MB("Error setting group id: ", rval);
+    char category[CATEGORY_TAG_SIZE];
+    rval = mdbImpl->tag_get_data(category_tag, &ci->second, 1, category);
+    CHK_MB_ERR_RET_MB("Error getting group category: ", rval);
+    rval = mdbImpl->tag_set_data(category_tag, &h, 1, category);
+    CHK_MB_ERR_RET_MB("Error setting group category: ", rval);
+  }
+
+  // The tolerances are carried by an empty set of their own, since the file
+  // set may hold the whole model
+  moab::EntityHandle tol_set;
+  rval = mdbImpl->create_meshset(moab::MESHSET_SET, tol_set);
+  CHK_MB_ERR_RET_MB("Error creating tolerance set: ", rval);
+  subsets.push_back(tol_set);
+  rval = mdbImpl->tag_set_data(faceting_tol_tag, &tol_set, 1, &faceting_tol);
+  CHK_MB_ERR_RET_MB("Error setting faceting tolerance tag: ", rval);
+  rval = mdbImpl->tag_set_data(geometry_resabs_tag, &tol_set, 1, &GEOMETRY_RESABS);
+  CHK_MB_ERR_RET_MB("Error setting geometry_resabs_tag: ", rval);
+  sets.insert(sets.end(), subsets.begin(), subsets.end());
+
+  // OBB trees are only referenced through tags, so their roots are added
+  // explicitly; the writer follows the tree from there
+  if (build_obb) {
+    for (moab::Range::iterator ci = closure.begin(); ci != closure.end(); ++ci) {
+      moab::EntityHandle set = *ci, root;
+      int dim;
+      rval = mdbImpl->tag_get_data(geom_tag, &set, 1, &dim);
+      CHK_MB_ERR_RET_MB("Error getting set dimension: ", rval);
+      if ((2 == dim || 3 == dim) && moab::MB_SUCCESS == myGeomTool->get_root(set, root))
+        sets.push_back(root);
+    }
+  }
+
+  rval = mdbImpl->write_file(filename.c_str(), 0, write_options.c_str(), &sets[0], sets.size());
+  CHK_MB_ERR_RET_MB("Error writing file: ", rval);
+  compress_output(filename);
+
+  rval = mdbImpl->delete_entities(&subsets[0], subsets.size());
+  CHK_MB_ERR_RET_MB("Error deleting temporary sets: ", rval);
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::record_profile(int dim, int id, moab::EntityHandle set,
+                                                   double seconds, size_t points, size_t facets)
+{
+  EntityProfile p = {dim, id, seconds, points, facets};
+  profiles.push_back(p);
+  if (!profile_tags)
+    return moab::MB_SUCCESS;
+
+  int num_points = points, num_facets = facets;
+  moab::ErrorCode rval = mdbImpl->tag_set_data(facet_time_tag, &set, 1, &seconds);
+  CHK_MB_ERR_RET_MB("Error setting facet time tag: ", rval);
+  rval = mdbImpl->tag_set_data(facet_points_tag, &set, 1, &num_points);
+  CHK_MB_ERR_RET_MB("Error setting facet point count tag: ", rval);
+  rval = mdbImpl->tag_set_data(facet_count_tag, &set, 1, &num_facets);
+  CHK_MB_ERR_RET_MB("Error setting facet count tag: ", rval);
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::seal_curves(refentity_handle_map& curve_map,
+                                                refentity_handle_map& surface_map, size_t& unsealed)
+{
+  moab::ErrorCode rval;
+  unsealed = 0;
+
+  // Gather the curve vertices and the surface triangles up front; the
+  // parallel stages below only work on these copies, since MOAB may not be
+  // used from several threads
+  std::vector<SealCurve> curves(curve_map.size());
+  std::vector<SealSurface> surfaces;
+
+  // Position in surfaces of each surface set, by its offset from the first
+  // surface handle; the sets of a dimension are created together, so the
+  // table is about as long as the surface map
+  moab::EntityHandle first_surface = 0, last_surface = 0;
+  for (refentity_handle_map_itor si = surface_map.begin(); si != surface_map.end(); ++si) {
+    if (!first_surface || si->second < first_surface)
+      first_surface = si->second;
+    last_surface = std::max(last_surface, si->second);
+  }
+  const size_t no_surface = (size_t)-1;
+  std::vector<size_t> surface_index(first_surface ? last_surface - first_surface + 1 : 0,
+                                    no_surface);
+  std::vector<moab::EntityHandle> curve_verts, parents;
+  std::vector<double> coords;
+  size_t c = 0;
+  for (refentity_handle_map_itor ci = curve_map.begin(); ci != curve_map.end(); ++ci, ++c) {
+    SealCurve& curve = curves[c];
+    curve.set = ci->second;
+    curve.id = ci->first->id();
+    curve.seconds = 0;
+    rval = mdbImpl->get_entities_by_type(curve.set, moab::MBVERTEX, curve.verts);
+    CHK_MB_ERR_RET_MB("Error getting curve vertices: ", rval);
+    coords.resize(3 * curve.verts.size());
+    if (!curve.verts.empty()) {
+      rval = mdbImpl->get_coords(&curve.verts[0], curve.verts.size(), &coords[0]);
+      CHK_MB_ERR_RET_MB("Error getting curve vertex coordinates: ", rval);
+    }
+    for (size_t i = 0; i < curve.verts.size(); ++i)
+      curve.points.push_back(CubitVector(coords[3*i], coords[3*i + 1], coords[3*i + 2]));
+    curve_verts.insert(curve_verts.end(), curve.verts.begin(), curve.verts.end());
+
+    parents.clear();
+    rval = mdbImpl->get_parent_meshsets(curve.set, parents);
+    CHK_MB_ERR_RET_MB("Error getting curve surfaces: ", rval);
+    for (size_t i = 0; i < parents.size(); ++i) {
+      if (parents[i] < first_surface || parents[i] > last_surface) {
+        message << "Curve " << curve.id << " has a parent that is not a surface" << std::endl;
+        return moab::MB_FAILURE;
+      }
+      size_t& si = surface_index[parents[i] - first_surface];
+      if (si == no_surface) {
+        si = surfaces.size();
+        surfaces.push_back(SealSurface());
+        SealSurface& surf = surfaces.back();
+        surf.set = parents[i];
+        moab::Range tris;
+        int num_facets;
+        rval = mdbImpl->get_entities_by_type(surf.set, moab::MBTRI, tris);
+        CHK_MB_ERR_RET_MB("Error getting surface facets: ", rval);
+        rval = mdbImpl->get_number_entities_by_dimension(surf.set, 2, num_facets);
+        CHK_MB_ERR_RET_MB("Error counting surface facets: ", rval);
+        surf.has_other_facets = num_facets != (int)tris.size();
+        rval = mdbImpl->get_connectivity(tris, surf.conn);
+        CHK_MB_ERR_RET_MB("Error getting surface connectivity: ", rval);
+      }
+      curve.surfaces.push_back(si);
+    }
+  }
+  std::sort(curve_verts.begin(), curve_verts.end());
+
+  // Find the boundary vertices of every surface, i.e. those of the
+  // triangle edges used once, that are not already curve vertices
+  parallel_for(surfaces.size(), num_threads, [&](size_t s) {
+    SealSurface& surf = surfaces[s];
+    std::vector<std::pair<moab::EntityHandle, moab::EntityHandle> > tri_edges;
+    for (size_t i = 0; i + 2 < surf.conn.size(); i += 3) {
+      for (int j = 0; j < 3; ++j) {
+        moab::EntityHandle a = surf.conn[i + j], b = surf.conn[i + (j + 1) % 3];
+        tri_edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+      }
+    }
+    std::sort(tri_edges.begin(), tri_edges.end());
+    for (size_t i = 0; i < tri_edges.size(); ) {
+      size_t j = i + 1;
+      while (j < tri_edges.size() && tri_edges[j] == tri_edges[i])
+        ++j;
+      if (j - i == 1) {
+        surf.skin.push_back(tri_edges[i].first);
+        surf.skin.push_back(tri_edges[i].second);
+      }
+      i = j;
+    }
+    std::sort(surf.skin.begin(), surf.skin.end());
+    surf.skin.erase(std::unique(surf.skin.begin(), surf.skin.end()), surf.skin.end());
+    size_t kept = 0;
+    for (size_t i = 0; i < surf.skin.size(); ++i) {
+      if (!std::binary_search(curve_verts.begin(), curve_verts.end(), surf.skin[i]))
+        surf.skin[kept++] = surf.skin[i];
+      else
+        surf.curve_skin.push_back(surf.skin[i]);
+    }
+    surf.skin.resize(kept);
+  });
+
+  for (size_t s = 0; s < surfaces.size(); ++s) {
+    SealSurface& surf = surfaces[s];
+    coords.resize(3 * surf.skin.size());
+    if (!surf.skin.empty()) {
+      rval = mdbImpl->get_coords(&surf.skin[0], surf.skin.size(), &coords[0]);
+      CHK_MB_ERR_RET_MB("Error getting surface vertex coordinates: ", rval);
+    }
+    for (size_t i = 0; i < surf.skin.size(); ++i)
+      surf.skin_points.push_back(CubitVector(coords[3*i], coords[3*i + 1], coords[3*i + 2]));
+  }
+
+  // Match the boundary vertices of the surfaces of each curve to the curve
+  // vertices, one curve per work unit
+  parallel_for(curves.size(), num_threads, [&](size_t c) {
+    SealCurve& curve = curves[c];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PointGrid grid(GEOMETRY_RESABS);
+    grid.build(curve.points);
+    for (size_t s = 0; s < curve.surfaces.size(); ++s) {
+      const SealSurface& surf = surfaces[curve.surfaces[s]];
+      for (size_t i = 0; i < surf.skin.size(); ++i) {
+        int j = grid.find(surf.skin_points[i]);
+        if (j >= 0) {
+          VertexMerge merge = {surf.set, surf.skin[i], curve.verts[j]};
+          curve.merges.push_back(merge);
+        }
+      }
+    }
+    curve.seconds = seconds_since(start);
+  });
+
+  // Merge serially in curve order so the result does not depend on the
+  // number of threads. A vertex matched by several curves goes to the first,
+  // and a curve vertex replaces at most one vertex of each surface so that no
+  // triangle collapses; the rest is left to make_watertight.
+  std::set<moab::EntityHandle> merged;
+  std::set<std::pair<moab::EntityHandle, moab::EntityHandle> > used;
+  for (size_t c = 0; c < curves.size(); ++c) {
+    const SealCurve& curve = curves[c];
+    for (size_t i = 0; i < curve.merges.size(); ++i) {
+      const VertexMerge& merge = curve.merges[i];
+      if (merged.count(merge.removed) || !used.insert(std::make_pair(merge.surface, merge.kept)).second)
+        continue;
+      merged.insert(merge.removed);
+      // Non-shared vertices belong to the one surface they were created for
+      rval = mdbImpl->remove_entities(merge.surface, &merge.removed, 1);
+      CHK_MB_ERR_RET_MB("Error removing merged vertex: ", rval);
+      rval = mdbImpl->add_entities(merge.surface, &merge.kept, 1);
+      CHK_MB_ERR_RET_MB("Error adding curve vertex: ", rval);
+      rval = mdbImpl->merge_entities(merge.kept, merge.removed, false, true);
+      CHK_MB_ERR_RET_MB("Error merging vertices: ", rval);
+    }
+  }
+  for (size_t c = 0; c < curves.size(); ++c) {
+    const SealCurve& curve = curves[c];
+    for (size_t i = 0; i < curve.merges.size(); ++i) {
+      const VertexMerge& merge = curve.merges[i];
+      if (merged.count(merge.removed))
+        surfaces[surface_index[merge.surface - first_surface]].curve_skin.push_back(merge.kept);
+    }
+  }
+
+  // A curve vertex missing from the boundary of one of its surfaces, e.g. at
+  // a T-junction, still leaves a gap for make_watertight
+  size_t junctions = 0;
+  for (size_t s = 0; s < surfaces.size(); ++s) {
+    std::vector<moab::EntityHandle>& curve_skin = surfaces[s].curve_skin;
+    std::sort(curve_skin.begin(), curve_skin.end());
+    curve_skin.erase(std::unique(curve_skin.begin(), curve_skin.end()), curve_skin.end());
+  }
+  for (size_t c = 0; c < curves.size(); ++c) {
+    const SealCurve& curve = curves[c];
+    for (size_t s = 0; s < curve.surfaces.size(); ++s) {
+      const std::vector<moab::EntityHandle>& curve_skin = surfaces[curve.surfaces[s]].curve_skin;
+      for (size_t i = 0; i < curve.verts.size(); ++i) {
+        if (!std::binary_search(curve_skin.begin(), curve_skin.end(), curve.verts[i]))
+          ++junctions;
+      }
+    }
+  }
+
+  size_t boundary_points = 0;
+  for (size_t s = 0; s < surfaces.size(); ++s) {
+    boundary_points += surfaces[s].skin.size();
+    // Other facets are left to make_watertight
+    if (surfaces[s].has_other_facets)
+      ++unsealed;
+  }
+  unsealed += boundary_points - merged.size() + junctions;
+  message << "Sealed " << merged.size() << " of " << boundary_points
+          << " surface boundary points to curve vertices" << std::endl;
+  if (junctions > 0)
+    message << junctions << " curve vertices are not on the boundary of a surface of their curve"
+            << std::endl;
+
+  // The slowest curves point at pathological ones
+  if (report_timing || verbose_warnings || profile_count > 0) {
+    std::vector<size_t> order(curves.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    const size_t num_slowest = std::min<size_t>(profile_count > 0 ? profile_count : 10, order.size());
+    std::partial_sort(order.begin(), order.begin() + num_slowest, order.end(),
+                      [&](size_t a, size_t b) { return curves[a].seconds > curves[b].seconds; });
+    message << "Slowest curves to seal:" << std::endl;
+    for (size_t i = 0; i < num_slowest; ++i) {
+      const SealCurve& curve = curves[order[i]];
+      message << "  curve " << curve.id << ": " << curve.seconds << " s, "
+              << curve.points.size() << " vertices, " << curve.merges.size()
+              << " matches" << std::endl;
+    }
+  }
+
+  return moab::MB_SUCCESS;
+}
+
+moab::ErrorCode DAGMCExportCommand::assign_element_ids()
+{
+  moab::ErrorCode rval;
+  std::vector<int> ids;
+
+  // Vertices, edges and facets are each numbered from 1 in handle order,
+  // which follows the order they were created in
+  for (int dim = 0; dim < 3; ++dim) {
+    moab::Range ents;
+    rval = mdbImpl->get_entities_by_dimension(0, dim, ents);
+    CHK_MB_ERR_RET_MB("Error getting entities to number: ", rval);
+    if (ents.empty())
+      continue;
+    ids.resize(ents.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+      ids[i] = i + 1;
+    rval = mdbImpl->tag_set_data(id_tag, ents, &ids[0]);
+    CHK_MB_ERR_RET_MB("Error setting element ids: ", rval);
+  }
+
+  return moab::MB_SUCCESS;
+}
+
+void DAGMCExportCommand::compress_output(const std::string& filename)
+{
+  if (compress_level <= 0)
+    return;
+
+  // A failure leaves the uncompressed file, which is still valid
+  std::ostringstream errors;
+  if (compress_h5_file(filename, compress_level, errors))
+    message << "Compressed " << filename << std::endl;
+  else
+    message << "Warning: could not compress " << filename << ": " << errors.str();
+}
+
+moab::ErrorCode DAGMCExportCommand::release_facets(moab::EntityHandle set, int dim)
+{
+  moab::ErrorCode rval;
+
+  // Vertices of the child sets belong to the bounding curves and geometric
+  // vertices, which are still in use
+  moab::Range facets, verts, children, keep;
+  rval = mdbImpl->get_entities_by_dimension(set, dim, facets);
+  CHK_MB_ERR_RET_MB("Error getting facets: ", rval);
+  rval = mdbImpl->get_entities_by_type(set, moab::MBVERTEX, verts);
+  CHK_MB_ERR_RET_MB("Error getting facet vertices: ", rval);
+  rval = mdbImpl->get_child_meshsets(set, children, 0);
+  CHK_MB_ERR_RET_MB("Error getting child sets: ", rval);
+  for (moab::Range::iterator c = children.begin(); c != children.end(); ++c) {
+    rval = mdbImpl->get_entities_by_type(*c, moab::MBVERTEX, keep);
+    CHK_MB_ERR_RET_MB("Error getting child vertices: ", rval);
+  }
+
+  rval = mdbImpl->remove_entities(set, facets);
+  CHK_MB_ERR_RET_MB("Error removing facets: ", rval);
+  rval = mdbImpl->remove_entities(set, verts);
+  CHK_MB_ERR_RET_MB("Error removing facet vertices: ", rval);
+  rval = mdbImpl->delete_entities(facets);
+  CHK_MB_ERR_RET_MB("Error deleting facets: ", rval);
+  rval = mdbImpl->delete_entities(moab::subtract(verts, keep));
+  CHK_MB_ERR_RET_MB("Error deleting facet vertices: ", rval);
+
+  return moab::MB_SUCCESS;
+}
@@ -4,18 +4,172 @@
 #include "CubitCommandInterface.hpp"
 #include "CubitMessageHandler.hpp"
 
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
 // CGM includes
 #include "RefEntity.hpp"
+#include "CubitVector.hpp"
 
 // MOAB includes
 #include "moab/Interface.hpp"
 #include "moab/GeomTopoTool.hpp"
+#include "moab/ReadUtilIface.hpp"
+
+#include "RefEntityHandleMap.hpp"
+#include "ExportTimer.hpp"
+#include "ExportProgress.hpp"
+#include "GeometrySignature.hpp"
+#include "FacetCache.hpp"
+#include "ExportSession.hpp"
 
 // make_watertight includes
 #include "make_watertight/MakeWatertight.hpp"
 
-typedef std::map<RefEntity*, moab::EntityHandle> refentity_handle_map;
-typedef std::map<RefEntity*, moab::EntityHandle>::iterator refentity_handle_map_itor;
+typedef RefEntityHandleMap refentity_handle_map;
+typedef RefEntityHandleMap::iterator refentity_handle_map_itor;
+
+class RefEdge;
+class RefFace;
+class RefVertex;
+class GMem;
+
+/*!
+ * \brief Faceting tolerances of a single curve or surface.
+ */
+struct FacetTolerance
+{
+  double faceting;
+  int normal;
+};
+
+/*!
+ * \brief Interior vertices of a faceted curve, kept so that the surfaces
+ * bounded by the curve can reuse them instead of creating their own.
+ */
+struct CurveVertices
+{
+  std::vector<CubitVector> points;
+  std::vector<moab::EntityHandle> handles;
+};
+
+/*!
+ * \brief Faceting results for a single curve, filled in by the (possibly
+ * concurrent) tessellation stage and consumed by the serial MOAB commit stage.
+ */
+struct CurveFacets
+{
+  //! Reset for reuse with another curve, keeping allocated storage
+  void clear();
+  //! Reset and free all storage, for tight_memory
+  void release();
+
+  RefEdge* edge;
+  moab::EntityHandle handle;
+  //! Tolerances the curve is faceted with
+  FacetTolerance tolerance;
+  //! Signature and reusable tessellation for incremental exports
+  GeometrySignature signature;
+  CachedFacets* cached;
+  CubitStatus status;
+  //! Set if the tessellation was skipped because another curve failed
+  //! with fatal_on_curves
+  bool skipped;
+  //! GMem buffer the curve is tessellated into
+  GMem* data;
+  //! Points, pointing into data, the incremental store or the storage below
+  const std::vector<CubitVector>* points;
+  //! Storage for tessellations read from the facet cache
+  std::vector<CubitVector> point_storage;
+  //! Time spent in CGM tessellating the curve
+  double facet_seconds;
+};
+
+/*!
+ * \brief Faceting results for a single surface, filled in by the (possibly
+ * concurrent) tessellation stage and consumed by the serial MOAB commit stage.
+ */
+struct SurfaceFacets
+{
+  //! Reset for reuse with another surface, keeping allocated storage
+  void clear();
+  //! Reset and free all storage, for tight_memory
+  void release();
+
+  RefFace* face;
+  moab::EntityHandle handle;
+  //! Tolerances the surface is faceted with
+  FacetTolerance tolerance;
+  //! Signature and reusable tessellation for incremental exports
+  GeometrySignature signature;
+  CachedFacets* cached;
+  //! Geometric vertices bounding the surface and their MOAB vertices
+  std::vector<RefVertex*> vertices;
+  std::vector<moab::EntityHandle> vertex_handles;
+  //! Faceted curves bounding the surface, used when sharing curve vertices
+  std::vector<const CurveVertices*> curves;
+  CubitStatus status;
+  //! GMem buffer the surface is tessellated into
+  GMem* data;
+  //! Points and facets, pointing into data, the incremental store or the
+  //! storage below
+  const std::vector<CubitVector>* points;
+  const std::vector<int>* facet_list;
+  //! Storage for tessellations read from the facet cache
+  std::vector<CubitVector> point_storage;
+  std::vector<int> facet_storage;
+  //! Points and facets written to MOAB: the tessellation above, or its
+  //! decimated or reordered copy in the storage below
+  const std::vector<CubitVector>* mesh_points;
+  const std::vector<int>* mesh_facet_list;
+  std::vector<CubitVector> mesh_point_storage;
+  std::vector<int> mesh_facet_storage;
+  //! Number of triangles removed by decimation
+  size_t removed_triangles;
+  //! Existing vertex coincident with each mesh point, or 0 if one must be
+  //! created; completed with the new vertices when the surface is committed
+  std::vector<moab::EntityHandle> point_handles;
+  //! Number of distance checks made while matching geometric vertices
+  size_t vertex_comparisons;
+  //! Number of boundary points that are not shared with a curve
+  size_t unsealed_points;
+  //! Warnings produced while tessellating, printed when the surface is committed
+  std::string warnings;
+  //! Time spent in CGM tessellating the surface
+  double facet_seconds;
+};
+
+/*!
+ * \brief Expected size of the faceted model, taken from the previous
+ * tessellation of each entity where there is one and estimated from the
+ * averages of earlier exports otherwise.
+ */
+struct ModelCensus
+{
+  size_t curves;
+  size_t surfaces;
+  size_t curve_points;
+  size_t surface_points;
+  size_t surface_facets;
+  //! Largest number of points of a single curve or surface
+  size_t max_points;
+  //! Number of curves and surfaces with a previous tessellation
+  size_t known;
+};
+
+/*!
+ * \brief Tessellation time and size of a single curve or surface.
+ */
+struct EntityProfile
+{
+  int dim;
+  int id;
+  double seconds;
+  size_t points;
+  size_t facets;
+};
 
 /*!
  * \brief The DAGMCExportCommand class implements all the steps necessary
@@ -36,7 +190,14 @@ public:
 protected:
 
   moab::ErrorCode create_tags();
-  moab::ErrorCode parse_options(CubitCommandData &data, moab::EntityHandle* file_set = 0);
+  moab::ErrorCode parse_options(CubitCommandData &data);
+  //! Find the volumes chosen with 'volume' and 'group' and the surfaces,
+  //! curves and vertices bounding them
+  moab::ErrorCode select_entities(CubitCommandData &data);
+  //! The entities of dimension dim to export, in id order
+  void model_entities(int dim, DLIList<RefEntity*>& entlist);
+  //! Whether ent or anything it holds is selected
+  bool holds_selection(RefEntity* ent);
   moab::ErrorCode create_entity_sets(refentity_handle_map (&entmap)[5]);
   moab::ErrorCode create_topology(refentity_handle_map (&entitymap)[5]);
   moab::ErrorCode store_surface_senses(refentity_handle_map& surface_map,
@@ -46,37 +207,198 @@ protected:
   moab::ErrorCode store_groups(refentity_handle_map (&entitymap)[5]);
   moab::ErrorCode create_group_entsets(refentity_handle_map& group_map);
   moab::ErrorCode store_group_content(refentity_handle_map (&entitymap)[5]);
-  moab::ErrorCode create_vertices(refentity_handle_map &vertex_map);
+  //! Make the MOAB vertex of each vertex set and map the geometric vertex
+  //! to it in vertex_map
+  moab::ErrorCode create_vertices(const refentity_handle_map &vertex_sets,
+                                  refentity_handle_map &vertex_map);
+  //! Facet the model with the given faceting tolerance and write it to
+  //! filename unless it is kept in memory, starting from the topology sets
+  //! and groups
+  moab::ErrorCode export_tolerance(refentity_handle_map (&entmap)[5], double tolerance,
+                                   const std::string& filename, bool write);
+  //! Find the tolerance of every curve and surface from 'facet_tol:' and
+  //! 'norm_tol:' groups and the auto_tolerance scaling
+  moab::ErrorCode resolve_tolerances(refentity_handle_map& curve_map,
+                                     refentity_handle_map& surface_map);
+  FacetTolerance tolerance_of(RefEntity* ent) const;
   moab::ErrorCode create_curve_facets(refentity_handle_map& curve_map,
                                       refentity_handle_map& vertex_map);
+  void facet_curve(CurveFacets& curve);
+  moab::ErrorCode commit_curve_facets(CurveFacets& curve, refentity_handle_map& vertex_map,
+                                      int& curve_warnings);
   moab::ErrorCode create_surface_facets(refentity_handle_map& surface_map,
                                         refentity_handle_map& vertex_map);
+  void facet_surface(SurfaceFacets& surf);
+  //! Sort the mesh points and facets of surf along a Morton curve
+  void reorder_facets(SurfaceFacets& surf);
+  moab::ErrorCode commit_surface_facets(SurfaceFacets& surf);
+  //! Estimate the size of the faceted model and reserve storage for it
+  void take_census(refentity_handle_map& curve_map, refentity_handle_map& surface_map);
+  //! Reset the faceting statistics, which accumulate over all facet phases
+  void start_faceting();
+  //! Report the faceting statistics and keep the incremental store
+  void finish_faceting(size_t num_curves, size_t num_surfaces);
+  //! Report histograms of the facets per surface, surfaces per volume and
+  //! facet edge lengths, and how many surface boundary points lie on curves
+  moab::ErrorCode report_statistics(refentity_handle_map (&entmap)[5]);
+  //! Facet and write the volumes batch_size at a time, one file per batch
+  moab::ErrorCode export_batches(refentity_handle_map (&entmap)[5],
+                                 const std::string& filename);
+  //! Write the faceted model as num_shards files of whole volumes
+  moab::ErrorCode write_shards(refentity_handle_map (&entmap)[5],
+                               const std::string& filename);
+  //! Write output_sets and their closure, with the groups restricted to them
+  moab::ErrorCode write_part(const std::string& filename,
+                             const std::vector<moab::EntityHandle>& output_sets,
+                             refentity_handle_map& group_map);
+  //! Keep the faceting profile of an entity, and tag it on set if requested
+  moab::ErrorCode record_profile(int dim, int id, moab::EntityHandle set,
+                                 double seconds, size_t points, size_t facets);
+  //! Merge the surface boundary vertices that coincide with curve vertices,
+  //! matching one curve per work unit on up to num_threads threads. Returns
+  //! the number of boundary points left unsealed in unsealed.
+  moab::ErrorCode seal_curves(refentity_handle_map& curve_map, refentity_handle_map& surface_map,
+                              size_t& unsealed);
+  //! Number the vertices and elements of each dimension contiguously
+  moab::ErrorCode assign_element_ids();
+  //! Compress the written file filename if requested
+  void compress_output(const std::string& filename);
+  //! Delete the facets of dimension dim in set and the vertices it owns
+  moab::ErrorCode release_facets(moab::EntityHandle set, int dim);
   moab::ErrorCode gather_ents(moab::EntityHandle gather_set);  
+  //! Whether the model kept by the session still has the same entities
+  bool kept_model_matches();
+  //! Delete all mesh and all sets but the vertex, curve, surface and volume
+  //! sets, which are emptied, and optionally the groups
+  moab::ErrorCode clear_mesh(refentity_handle_map (&entmap)[5], bool keep_groups);
+  //! Delete everything but the vertex, curve, surface and volume sets and
+  //! their topology, and keep those in the session for the next export
+  moab::ErrorCode keep_topology(refentity_handle_map (&entmap)[5]);
+  //! Empty the instance, including the tags of the export
+  moab::ErrorCode reset_instance();
+  //! Delete the tags holding data of a single export and, with topology,
+  //! also the name and category tags of the sets
+  moab::ErrorCode delete_export_tags(bool topology);
+  //! Clear the handles of the tags deleted by delete_export_tags
+  void forget_tag_handles(bool topology);
+  //! Print the faceting summary of the last export_tolerance
+  void print_summary();
   moab::ErrorCode teardown();
+  //! Print the messages of a failed or interrupted export and release the
+  //! MOAB instance
+  void abort_export();
 
 private:
 
+  //! Owner of the MOAB instance and tools shared by all exports
+  ExportSession* session;
   moab::Interface* mdbImpl;
   moab::GeomTopoTool* myGeomTool;
+  moab::ReadUtilIface* readUtil;
   CubitMessageHandler* console;
 
   std::ostringstream message;
 
+  ExportTimer timer;
+  ExportProgress progress;
+  double progress_interval;
+
+  //! Scratch storage reused while committing facets
+  std::vector<moab::EntityHandle> facet_corners;
+
   moab::Tag geom_tag, id_tag, name_tag, category_tag, faceting_tol_tag, geometry_resabs_tag;
+  std::vector<moab::Tag> extra_name_tags;
 
   int norm_tol;
   double faceting_tol;
+  //! Faceting tolerances to export with, one file each
+  std::vector<double> faceting_tols;
+  //! Entities of each dimension chosen with 'volume' and 'group', in id
+  //! order, and all of them together; empty to export the whole model
+  std::vector<RefEntity*> selection[4];
+  std::set<RefEntity*> selected;
   double len_tol;
   bool verbose_warnings;
   bool fatal_on_curves;
   bool make_watertight;
-  
+  int num_threads;
+  bool share_vertices;
+  bool report_timing;
+  bool incremental;
+  //! Free each tessellation as soon as it is in MOAB and keep none for
+  //! incremental exports
+  bool tight_memory;
+  //! Keep the topology sets in the instance for the next export
+  bool keep_mesh;
+  int batch_size;
+  int num_shards;
+  std::string write_options;
+  bool compact;
+  int compress_level;
+  bool element_ids;
+  bool build_obb;
+  //! Report the statistics of the faceted model, and with dry_run skip
+  //! everything after faceting, writing included
+  bool stats;
+  bool dry_run;
+  //! Hand the model of the last tolerance over through the in-memory API
+  //! instead of writing it, and its file set
+  bool in_memory;
+  moab::EntityHandle output_set;
+  //! Merge coplanar surface triangles within the angle (degrees) and distance
+  bool decimate;
+  double decimation_angle, decimation_distance;
+  //! Order the new vertices and the facets of each surface along a Morton curve
+  bool reorder;
+  size_t removed_triangle_count;
+  //! Number of slowest entities listed in the summary, 0 for no profile
+  int profile_count;
+  //! Surface tolerance as a fraction of its bounding box diagonal, 0 for off
+  double auto_tolerance;
+  //! Tolerances of the curves and surfaces that do not use the global ones
+  std::map<RefEntity*, FacetTolerance> entity_tolerances;
+  moab::Tag surface_faceting_tol_tag, surface_normal_tol_tag;
+  bool profile_tags;
+  moab::Tag facet_time_tag, facet_points_tag, facet_count_tag;
+  std::vector<EntityProfile> profiles;
+  std::string timing_file;
+
+  //! Expected size of the current export, and the actual size so far
+  ModelCensus census;
+  size_t curve_point_count, surface_point_count, surface_facet_count;
+  //! Averages over the entities of the last export, used for the census
+  double points_per_curve, points_per_surface, facets_per_surface;
+
   int failed_curve_count;
   std::vector<int> failed_curves;
 
   int failed_surface_count;
   std::vector<int> failed_surfaces;
 
+  //! MOAB vertex of each geometric vertex of the current export; the
+  //! vertex sets themselves are in entmap[0]
+  refentity_handle_map vertex_handles;
+
+  //! Interior curve vertices by curve, filled when sharing curve vertices
+  std::map<RefEntity*, CurveVertices> curve_vertices;
+  size_t unsealed_point_count;
+
+  //! Tessellations from the previous export by entity id, reused for
+  //! unchanged entities in incremental mode
+  std::map<int, CachedFacets> curve_cache, surface_cache;
+  std::map<int, CachedFacets> next_curve_cache, next_surface_cache;
+  int reused_curve_count, reused_surface_count;
+  double cached_faceting_tol, cached_len_tol;
+  int cached_norm_tol;
+
+  //! Tessellations stored on disk across exports and models
+  FacetCache facet_cache;
+  std::string facet_cache_dir;
+
+  //! Held around every get_graphics call. The tessellation is not documented
+  //! as re-entrant, so only the work before and after it runs concurrently.
+  std::mutex graphics_mutex;
+
 
 };
 
@@ -0,0 +1,97 @@
+#include "ExportProgress.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include "AppUtil.hpp"
+#include "CubitInterface.hpp"
+#include "CubitMessageHandler.hpp"
+
+namespace {
+
+void print_duration(std::ostream& out, double seconds)
+{
+  long total = (long)(seconds + 0.5);
+  if (total >= 3600)
+    out << total / 3600 << "h " << (total % 3600) / 60 << "m";
+  else if (total >= 60)
+    out << total / 60 << "m " << total % 60 << "s";
+  else
+    out << total << "s";
+}
+
+}
+
+ExportProgress::ExportProgress() :
+  numEntities(0), totalWork(0), entitiesDone(0), workDone(0), nextPoll(1),
+  pollStride(1), interval(10.0), lastReport(0), reported(false), interrupted(false)
+{}
+
+void ExportProgress::start(const std::string& phase, size_t num_entities, size_t total_work)
+{
+  phaseName = phase;
+  numEntities = num_entities;
+  totalWork = total_work;
+  entitiesDone = workDone = 0;
+  // About a thousand polls per phase, however large it is
+  pollStride = std::max<size_t>(1, num_entities / 1000);
+  nextPoll = pollStride;
+  lastReport = 0;
+  reported = false;
+  interrupted = false;
+  startTime = std::chrono::steady_clock::now();
+}
+
+bool ExportProgress::check_interrupt()
+{
+  if (!interrupted && AppUtil::instance()->interrupt())
+    interrupted = true;
+  return interrupted;
+}
+
+double ExportProgress::elapsed() const
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void ExportProgress::poll()
+{
+  nextPoll = entitiesDone + pollStride;
+
+  if (check_interrupt())
+    return;
+
+  const double seconds = elapsed();
+  if (interval <= 0 || seconds - lastReport < interval)
+    return;
+  lastReport = seconds;
+  reported = true;
+
+  // The work estimate may be off, so the fraction is capped short of done
+  double fraction = totalWork > 0 ? (double)workDone / totalWork
+                                  : numEntities > 0 ? (double)entitiesDone / numEntities : 0;
+  fraction = std::min(fraction, 0.99);
+
+  std::ostringstream out;
+  out << phaseName << ": " << entitiesDone << " of " << numEntities << " ("
+      << (int)(100 * fraction) << "%), " << (seconds > 0 ? entitiesDone / seconds : 0) << "/s";
+  if (fraction > 0) {
+    out << ", about ";
+    print_duration(out, seconds * (1 - fraction) / fraction);
+    out << " left";
+  }
+  out << std::endl;
+  CubitInterface::get_cubit_message_handler()->print_message(out.str().c_str());
+}
+
+void ExportProgress::finish()
+{
+  if (!reported)
+    return;
+
+  std::ostringstream out;
+  out << phaseName << ": " << entitiesDone << " of " << numEntities << " done in ";
+  print_duration(out, elapsed());
+  out << std::endl;
+  CubitInterface::get_cubit_message_handler()->print_message(out.str().c_str());
+}
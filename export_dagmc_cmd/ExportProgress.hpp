@@ -0,0 +1,67 @@
+#ifndef EXPORTPROGRESS_HPP
+#define EXPORTPROGRESS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+/*!
+ * \brief The ExportProgress class prints the progress of a long export phase
+ * through the Cubit message handler and checks Cubit's interrupt flag.
+ *
+ * Work is counted in entities and in estimated work units, e.g. points or
+ * facets, which give the fraction done and so the time left. The clock and
+ * the interrupt flag are only checked every few entities and a report is only
+ * printed every interval seconds, so advance() is cheap enough for the
+ * commit loops. Only check_interrupt() and cancelled() may be called from
+ * the faceting threads.
+ */
+class ExportProgress
+{
+public:
+  ExportProgress();
+
+  //! Seconds between reports; 0 disables them, but not the interrupt check
+  void set_interval(double seconds) { interval = seconds; }
+
+  //! Begin a phase over num_entities entities and about total_work units
+  void start(const std::string& phase, size_t num_entities, size_t total_work);
+
+  //! Record one more entity of the given work. Returns false once the user
+  //! has interrupted the export.
+  bool advance(size_t work)
+  {
+    ++entitiesDone;
+    workDone += work;
+    if (entitiesDone >= nextPoll)
+      poll();
+    return !interrupted;
+  }
+
+  //! Print the time taken if the phase was long enough to be reported
+  void finish();
+
+  //! Check the interrupt flag now rather than at the next poll, e.g. before
+  //! each tessellation of a worker thread. Returns true once the user has
+  //! interrupted the export.
+  bool check_interrupt();
+
+  bool cancelled() const { return interrupted; }
+
+private:
+  void poll();
+  double elapsed() const;
+
+  std::string phaseName;
+  size_t numEntities, totalWork;
+  size_t entitiesDone, workDone;
+  size_t nextPoll, pollStride;
+  double interval;
+  double lastReport;
+  bool reported;
+  std::atomic<bool> interrupted;
+  std::chrono::steady_clock::time_point startTime;
+};
+
+#endif // EXPORTPROGRESS_HPP
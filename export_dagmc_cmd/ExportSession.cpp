@@ -0,0 +1,115 @@
+#include "ExportSession.hpp"
+
+#include "MBTagConventions.hpp"
+
+ExportSession& ExportSession::shared()
+{
+  static ExportSession session;
+  return session;
+}
+
+ExportSession::ExportSession() :
+  geomTool(0), makeWatertight(0), hasModel(false), inExport(false), handoffSet(0),
+  handoffCompressLevel(0)
+{}
+
+ExportSession::~ExportSession()
+{
+  delete makeWatertight;
+  delete geomTool;
+}
+
+moab::GeomTopoTool* ExportSession::geom_tool()
+{
+  if (!geomTool)
+    geomTool = new moab::GeomTopoTool(&core);
+  return geomTool;
+}
+
+MakeWatertight* ExportSession::watertight()
+{
+  if (!makeWatertight)
+    makeWatertight = new MakeWatertight(&core);
+  return makeWatertight;
+}
+
+void ExportSession::begin_export()
+{
+  if (inExport)
+    forget_model();
+  // The export replaces a handed-off model
+  handoffSet = 0;
+  inExport = true;
+}
+
+moab::ErrorCode ExportSession::reset()
+{
+  // The tools cache sets of the mesh, so they go with it
+  delete makeWatertight;
+  makeWatertight = 0;
+  delete geomTool;
+  geomTool = 0;
+  forget_model();
+  handoffSet = 0;
+  moab::ErrorCode rval = core.delete_mesh();
+  if (moab::MB_SUCCESS != rval)
+    return rval;
+  return delete_export_tags(true);
+}
+
+moab::ErrorCode ExportSession::delete_export_tags(bool topology)
+{
+  // GEOM_DIMENSION and GLOBAL_ID are shared with the GeomTopoTool and MOAB
+  // itself, so they stay and only lose their data with the mesh
+  std::vector<moab::Tag> tags;
+  moab::ErrorCode rval = core.tag_get_tags(tags);
+  if (moab::MB_SUCCESS != rval)
+    return rval;
+
+  const std::string extra_name = std::string("EXTRA_") + NAME_TAG_NAME;
+  const char* const export_tags[] = {"FACETING_TOL", "GEOMETRY_RESABS", "SURFACE_FACETING_TOL",
+                                     "SURFACE_NORMAL_TOL", "FACET_TIME", "FACET_POINTS",
+                                     "FACET_COUNT"};
+  for (size_t i = 0; i < tags.size(); ++i) {
+    std::string name;
+    rval = core.tag_get_name(tags[i], name);
+    if (moab::MB_SUCCESS != rval)
+      return rval;
+
+    bool remove = 0 == name.compare(0, extra_name.size(), extra_name) ||
+                  (topology && (name == NAME_TAG_NAME || name == CATEGORY_TAG_NAME));
+    for (size_t j = 0; j < sizeof(export_tags) / sizeof(export_tags[0]); ++j)
+      remove = remove || name == export_tags[j];
+    if (remove) {
+      rval = core.tag_delete(tags[i]);
+      if (moab::MB_SUCCESS != rval)
+        return rval;
+    }
+  }
+  return moab::MB_SUCCESS;
+}
+
+void ExportSession::keep_model(const KeptModel& kept)
+{
+  model = kept;
+  hasModel = true;
+}
+
+void ExportSession::forget_model()
+{
+  for (int dim = 0; dim < 4; ++dim) {
+    model.sets[dim].clear();
+    model.ids[dim].clear();
+  }
+  hasModel = false;
+}
+
+void ExportSession::hand_off(moab::EntityHandle file_set, const std::string& filename,
+                             const std::string& write_options, int compress_level)
+{
+  forget_model();
+  handoffSet = file_set;
+  handoffFilename = filename;
+  handoffOptions = write_options;
+  handoffCompressLevel = compress_level;
+}
@@ -0,0 +1,96 @@
+#ifndef EXPORTSESSION_HPP
+#define EXPORTSESSION_HPP
+
+#include <string>
+#include <vector>
+
+#include "moab/Core.hpp"
+#include "moab/GeomTopoTool.hpp"
+
+#include "RefEntityHandleMap.hpp"
+
+// make_watertight includes
+#include "make_watertight/MakeWatertight.hpp"
+
+/*!
+ * \brief The ExportSession class owns the MOAB instance and the tools used
+ * on it by every export in a Cubit session, so that repeated exports reuse
+ * them instead of allocating new ones.
+ *
+ * Between exports the instance either holds nothing, only the topology
+ * sets of the last exported model when it was kept for the next export, or
+ * the whole last model when it was handed off in memory.
+ */
+class ExportSession
+{
+public:
+  //! The session shared by all export commands
+  static ExportSession& shared();
+
+  ~ExportSession();
+
+  moab::Interface* mdb() { return &core; }
+  moab::GeomTopoTool* geom_tool();
+  MakeWatertight* watertight();
+
+  //! Mark the start of an export. An export that did not end cleanly leaves
+  //! unknown contents behind, so any kept model is forgotten and the
+  //! instance must be reset.
+  void begin_export();
+
+  //! Mark the end of an export that left the instance reset or kept
+  void end_export() { inExport = false; }
+
+  //! Delete all mesh, sets and export tags and the tools, which are rebuilt
+  //! on next use
+  moab::ErrorCode reset();
+
+  //! Delete the tags holding data of a single export and, with topology,
+  //! also the name and category tags of the sets. Tags are found by name as
+  //! any command object may have made them.
+  moab::ErrorCode delete_export_tags(bool topology);
+
+  //! Topology sets of the vertices, curves, surfaces and volumes of the last
+  //! exported model, with the id of each entity when it was kept
+  struct KeptModel
+  {
+    RefEntityHandleMap sets[4];
+    std::vector<int> ids[4];
+  };
+
+  //! The kept model, or 0 if there is none
+  const KeptModel* kept_model() const { return hasModel ? &model : 0; }
+  void keep_model(const KeptModel& kept);
+  void forget_model();
+
+  //! Leave the whole exported model in the instance for the caller of the
+  //! in-memory API, with the set holding it and the file, writer options and
+  //! deflate level it was not written with. It stays until the next export
+  //! or reset.
+  void hand_off(moab::EntityHandle file_set, const std::string& filename,
+                const std::string& write_options, int compress_level);
+  //! The file set of the handed-off model, or 0 if there is none
+  moab::EntityHandle handed_off_set() const { return handoffSet; }
+  const std::string& handoff_filename() const { return handoffFilename; }
+  const std::string& handoff_write_options() const { return handoffOptions; }
+  int handoff_compress_level() const { return handoffCompressLevel; }
+
+private:
+  ExportSession();
+  ExportSession(const ExportSession&);
+  ExportSession& operator=(const ExportSession&);
+
+  moab::Core core;
+  moab::GeomTopoTool* geomTool;
+  MakeWatertight* makeWatertight;
+
+  KeptModel model;
+  bool hasModel;
+  bool inExport;
+
+  moab::EntityHandle handoffSet;
+  std::string handoffFilename, handoffOptions;
+  int handoffCompressLevel;
+};
+
+#endif // EXPORTSESSION_HPP
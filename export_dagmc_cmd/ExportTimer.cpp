@@ -0,0 +1,141 @@
+#include "ExportTimer.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+ExportTimer::ExportTimer() :
+  mdbImpl(0), running(false), startWall(0), startCpu(0), startRss(0), startEntities(0)
+{}
+
+void ExportTimer::reset(moab::Interface* mdb)
+{
+  mdbImpl = mdb;
+  phases.clear();
+  running = false;
+}
+
+void ExportTimer::start(const std::string& phase)
+{
+  stop();
+
+  Phase p;
+  p.name = phase;
+  p.wall_time = p.cpu_time = 0.0;
+  p.peak_rss_delta = p.entities = 0;
+  phases.push_back(p);
+
+  running = true;
+  startEntities = num_entities();
+  startRss = peak_rss();
+  startCpu = cpu_clock();
+  startWall = wall_clock();
+}
+
+void ExportTimer::stop()
+{
+  if (!running)
+    return;
+  running = false;
+
+  Phase& p = phases.back();
+  p.wall_time = wall_clock() - startWall;
+  p.cpu_time = cpu_clock() - startCpu;
+  p.peak_rss_delta = peak_rss() - startRss;
+  p.entities = num_entities() - startEntities;
+}
+
+void ExportTimer::print(std::ostream& out) const
+{
+  double total_wall = 0.0, total_cpu = 0.0;
+  long total_rss = 0, total_entities = 0;
+
+  out << "----- Export Timing Information -----" << std::endl;
+  out << std::left << std::setw(24) << "phase" << std::right
+      << std::setw(12) << "wall (s)"
+      << std::setw(12) << "cpu (s)"
+      << std::setw(16) << "peak RSS (kB)"
+      << std::setw(12) << "entities" << std::endl;
+  out << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const Phase& p = phases[i];
+    out << std::left << std::setw(24) << p.name << std::right
+        << std::setw(12) << p.wall_time
+        << std::setw(12) << p.cpu_time
+        << std::setw(16) << p.peak_rss_delta
+        << std::setw(12) << p.entities << std::endl;
+    total_wall += p.wall_time;
+    total_cpu += p.cpu_time;
+    total_rss += p.peak_rss_delta;
+    total_entities += p.entities;
+  }
+  out << std::left << std::setw(24) << "total" << std::right
+      << std::setw(12) << total_wall
+      << std::setw(12) << total_cpu
+      << std::setw(16) << total_rss
+      << std::setw(12) << total_entities << std::endl;
+  out.unsetf(std::ios::floatfield);
+}
+
+bool ExportTimer::write_json(const std::string& filename) const
+{
+  std::ofstream out(filename.c_str());
+  if (!out)
+    return false;
+
+  out << "{" << std::endl << "  \"phases\": [" << std::endl;
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const Phase& p = phases[i];
+    out << "    {\"name\": \"" << p.name << "\""
+        << ", \"wall_time\": " << p.wall_time
+        << ", \"cpu_time\": " << p.cpu_time
+        << ", \"peak_rss_delta_kb\": " << p.peak_rss_delta
+        << ", \"entities\": " << p.entities << "}"
+        << (i + 1 < phases.size() ? "," : "") << std::endl;
+  }
+  out << "  ]" << std::endl << "}" << std::endl;
+
+  return out.good();
+}
+
+double ExportTimer::wall_clock()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double ExportTimer::cpu_clock()
+{
+  // Process CPU time, summed over all threads
+  return (double)std::clock() / CLOCKS_PER_SEC;
+}
+
+long ExportTimer::peak_rss()
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+#ifdef __APPLE__
+  // Reported in bytes rather than kB on macOS
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+long ExportTimer::num_entities() const
+{
+  int count = 0;
+  if (mdbImpl)
+    mdbImpl->get_number_entities_by_handle(0, count);
+  return count;
+}
@@ -0,0 +1,60 @@
+#ifndef EXPORTTIMER_HPP
+#define EXPORTTIMER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "moab/Interface.hpp"
+
+/*!
+ * \brief The ExportTimer class records wall time, CPU time, peak memory
+ * growth and the number of MOAB entities created for each phase of an
+ * export.
+ */
+class ExportTimer
+{
+public:
+  ExportTimer();
+
+  //! Forget all recorded phases; entity counts are taken from mdb
+  void reset(moab::Interface* mdb);
+
+  //! Begin a new phase, ending the current one if there is one
+  void start(const std::string& phase);
+
+  //! End the current phase
+  void stop();
+
+  //! Print a table of all recorded phases
+  void print(std::ostream& out) const;
+
+  //! Write all recorded phases as JSON. Returns false on failure.
+  bool write_json(const std::string& filename) const;
+
+private:
+  struct Phase
+  {
+    std::string name;
+    double wall_time;
+    double cpu_time;
+    //! Growth of the peak resident set size during the phase, in kB
+    long peak_rss_delta;
+    //! Entities created minus entities deleted during the phase
+    long entities;
+  };
+
+  static double wall_clock();
+  static double cpu_clock();
+  static long peak_rss();
+  long num_entities() const;
+
+  moab::Interface* mdbImpl;
+  std::vector<Phase> phases;
+  bool running;
+
+  double startWall, startCpu;
+  long startRss, startEntities;
+};
+
+#endif // EXPORTTIMER_HPP
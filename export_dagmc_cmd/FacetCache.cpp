@@ -0,0 +1,186 @@
+#include "FacetCache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'D', 'A', 'G', 'M', 'C', 'F', 'C', '1'};
+
+template <class T>
+void write_value(std::ostream& out, const T& value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+bool read_value(std::istream& in, T& value)
+{
+  return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+}
+
+FacetCache::FacetCache() :
+  facetingTol(0.0), lenTol(0.0), normTol(0), numHits(0), numMisses(0)
+{}
+
+bool FacetCache::open(const std::string& dir, double faceting_tol, int norm_tol, double len_tol)
+{
+  cacheDir = dir;
+  facetingTol = faceting_tol;
+  normTol = norm_tol;
+  lenTol = len_tol;
+  if (cacheDir.empty())
+    return true;
+
+#ifdef _WIN32
+  int err = _mkdir(cacheDir.c_str());
+#else
+  int err = mkdir(cacheDir.c_str(), 0755);
+#endif
+  if (err && EEXIST != errno) {
+    cacheDir.clear();
+    return false;
+  }
+  return true;
+}
+
+void FacetCache::reset_statistics()
+{
+  numHits = 0;
+  numMisses = 0;
+}
+
+std::string FacetCache::file_name(char kind, const GeometrySignature& signature) const
+{
+  // Mix the tolerances into the signature hash with the same scheme
+  // GeometrySignature uses for its members
+  unsigned long long key = signature.hash();
+  const double tols[2] = {facetingTol, lenTol};
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(tols);
+  for (size_t i = 0; i < sizeof(tols); ++i) {
+    key ^= bytes[i];
+    key *= 1099511628211ULL;
+  }
+  key ^= (unsigned long long)normTol;
+  key *= 1099511628211ULL;
+
+  char name[32];
+  std::sprintf(name, "%c%016llx.facets", kind, key);
+  return cacheDir + "/" + name;
+}
+
+bool FacetCache::load(char kind, const GeometrySignature& signature,
+                      std::vector<CubitVector>& points, std::vector<int>& facet_list)
+{
+  if (!enabled())
+    return false;
+
+  std::ifstream in(file_name(kind, signature).c_str(), std::ios::binary);
+
+  // Check the header in case of hash collisions or a foreign file
+  char magic[sizeof(CACHE_MAGIC)];
+  GeometrySignature stored;
+  double faceting_tol, len_tol;
+  int norm_tol;
+  unsigned long long num_points, num_facet_ints;
+  if (!in || !in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC) ||
+      !stored.read(in) || stored != signature ||
+      !read_value(in, faceting_tol) || faceting_tol != facetingTol ||
+      !read_value(in, norm_tol) || norm_tol != normTol ||
+      !read_value(in, len_tol) || len_tol != lenTol ||
+      !read_value(in, num_points) || !read_value(in, num_facet_ints)) {
+    ++numMisses;
+    return false;
+  }
+
+  // The counts of a corrupt entry must not make the vectors larger than
+  // the rest of the file
+  const std::streampos data_start = in.tellg();
+  in.seekg(0, std::ios::end);
+  const unsigned long long remaining = (unsigned long long)(in.tellg() - data_start);
+  in.seekg(data_start);
+  const unsigned long long point_bytes = 3 * sizeof(double);
+  if (!in || num_points > remaining / point_bytes ||
+      num_facet_ints > (remaining - num_points * point_bytes) / sizeof(int)) {
+    ++numMisses;
+    return false;
+  }
+
+  std::vector<double> coords(3 * num_points);
+  facet_list.resize(num_facet_ints);
+  if (!in.read(reinterpret_cast<char*>(coords.data()), coords.size() * sizeof(double)) ||
+      !in.read(reinterpret_cast<char*>(facet_list.data()), facet_list.size() * sizeof(int))) {
+    ++numMisses;
+    facet_list.clear();
+    return false;
+  }
+
+  points.resize(num_points);
+  for (size_t i = 0; i < num_points; ++i)
+    points[i] = CubitVector(coords[3*i], coords[3*i + 1], coords[3*i + 2]);
+
+  ++numHits;
+  return true;
+}
+
+bool FacetCache::store(char kind, const GeometrySignature& signature,
+                       const std::vector<CubitVector>& points, const std::vector<int>& facet_list)
+{
+  if (!enabled())
+    return false;
+
+  // Write to a private file first and rename it into place, so that readers
+  // never see a partially written entry. The process and thread ids keep
+  // the file private to this writer, also across processes sharing the
+  // cache directory.
+  std::string name = file_name(kind, signature);
+  std::ostringstream tmp_name;
+#ifdef _WIN32
+  tmp_name << name << ".tmp" << _getpid() << "_" << std::this_thread::get_id();
+#else
+  tmp_name << name << ".tmp" << getpid() << "_" << std::this_thread::get_id();
+#endif
+
+  {
+    std::ofstream out(tmp_name.str().c_str(), std::ios::binary);
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    signature.write(out);
+    write_value(out, facetingTol);
+    write_value(out, normTol);
+    write_value(out, lenTol);
+    write_value(out, (unsigned long long)points.size());
+    write_value(out, (unsigned long long)facet_list.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      double coords[3] = {points[i].x(), points[i].y(), points[i].z()};
+      out.write(reinterpret_cast<const char*>(coords), sizeof(coords));
+    }
+    out.write(reinterpret_cast<const char*>(facet_list.data()), facet_list.size() * sizeof(int));
+    if (!out) {
+      out.close();
+      std::remove(tmp_name.str().c_str());
+      return false;
+    }
+  }
+
+  std::remove(name.c_str());
+  if (std::rename(tmp_name.str().c_str(), name.c_str())) {
+    std::remove(tmp_name.str().c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef FACETCACHE_HPP
+#define FACETCACHE_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "CubitVector.hpp"
+#include "GeometrySignature.hpp"
+
+/*!
+ * \brief The FacetCache class stores curve and surface tessellations on disk,
+ * one file per entity, keyed by the geometry signature and the faceting
+ * tolerances. It lets repeated exports of the same parts skip the CGM
+ * tessellation. Loading and storing may be done from several threads.
+ */
+class FacetCache
+{
+public:
+  FacetCache();
+
+  //! Use the given directory for the cache, creating it if needed. An empty
+  //! directory disables the cache. Returns false if the directory cannot be
+  //! created.
+  bool open(const std::string& dir, double faceting_tol, int norm_tol, double len_tol);
+
+  bool enabled() const { return !cacheDir.empty(); }
+
+  //! Read a cached tessellation; kind distinguishes curves from surfaces.
+  //! Returns false on a cache miss.
+  bool load(char kind, const GeometrySignature& signature,
+            std::vector<CubitVector>& points, std::vector<int>& facet_list);
+
+  //! Write a tessellation to the cache. Returns false if it could not be
+  //! written.
+  bool store(char kind, const GeometrySignature& signature,
+             const std::vector<CubitVector>& points, const std::vector<int>& facet_list);
+
+  size_t hits() const { return numHits; }
+  size_t misses() const { return numMisses; }
+  void reset_statistics();
+
+private:
+  std::string file_name(char kind, const GeometrySignature& signature) const;
+
+  std::string cacheDir;
+  double facetingTol, lenTol;
+  int normTol;
+
+  std::atomic<size_t> numHits, numMisses;
+};
+
+#endif // FACETCACHE_HPP
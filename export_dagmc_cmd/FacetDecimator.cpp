@@ -0,0 +1,295 @@
+#include "FacetDecimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// Twice the signed area of the 2D triangle (a, b, c)
+double cross2d(const double* a, const double* b, const double* c)
+{
+  return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+// Whether p is inside or on the counterclockwise 2D triangle (a, b, c)
+bool in_triangle(const double* p, const double* a, const double* b, const double* c)
+{
+  return cross2d(a, b, p) >= 0 && cross2d(b, c, p) >= 0 && cross2d(c, a, p) >= 0;
+}
+
+}
+
+FacetDecimator::FacetDecimator(double max_angle, double max_distance) :
+  minCos(std::cos(max_angle * M_PI / 180.0)), maxDistance(max_distance), pointList(0)
+{}
+
+size_t FacetDecimator::decimate(const std::vector<CubitVector>& points,
+                                const std::vector<int>& facet_list,
+                                const std::vector<bool>& fixed,
+                                std::vector<CubitVector>& out_points,
+                                std::vector<int>& out_facet_list,
+                                std::vector<int>& kept_points)
+{
+  pointList = &points;
+  triangles.clear();
+  incident.assign(points.size(), std::vector<int>());
+  std::vector<bool> keep(fixed);
+  keep.resize(points.size(), false);
+
+  // Triangles are decimated; other facets are passed through and keep their
+  // vertices
+  std::vector<int> others;
+  for (size_t i = 0; i < facet_list.size(); i += facet_list[i] + 1) {
+    int num_verts = facet_list[i];
+    if (num_verts == 3) {
+      Triangle tri = {{facet_list[i + 1], facet_list[i + 2], facet_list[i + 3]}, true};
+      for (int j = 0; j < 3; ++j)
+        incident[tri.v[j]].push_back(triangles.size());
+      triangles.push_back(tri);
+    }
+    else {
+      others.insert(others.end(), facet_list.begin() + i, facet_list.begin() + i + num_verts + 1);
+      for (int j = 1; j <= num_verts; ++j)
+        keep[facet_list[i + j]] = true;
+    }
+  }
+  const size_t num_triangles = triangles.size();
+
+  // Vertices of boundary and non-manifold edges stay in place
+  std::vector<std::pair<int, int> > edges;
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    for (int j = 0; j < 3; ++j) {
+      int a = triangles[t].v[j], b = triangles[t].v[(j + 1) % 3];
+      edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size(); ) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j] == edges[i])
+      ++j;
+    if (j - i != 2)
+      keep[edges[i].first] = keep[edges[i].second] = true;
+    i = j;
+  }
+
+  // Remove vertices in index order so that the result is deterministic
+  removing.assign(triangles.size(), 0);
+  for (size_t v = 0; v < points.size(); ++v) {
+    if (!keep[v] && incident[v].size() >= 3)
+      remove_vertex(v);
+  }
+
+  // Compact the points that are still used
+  std::vector<int> new_index(points.size(), -1);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    if (triangles[t].alive) {
+      for (int j = 0; j < 3; ++j)
+        new_index[triangles[t].v[j]] = 0;
+    }
+  }
+  for (size_t i = 0; i < others.size(); i += others[i] + 1) {
+    for (int j = 1; j <= others[i]; ++j)
+      new_index[others[i + j]] = 0;
+  }
+  out_points.clear();
+  kept_points.clear();
+  for (size_t i = 0; i < points.size(); ++i) {
+    if (new_index[i] < 0)
+      continue;
+    new_index[i] = out_points.size();
+    out_points.push_back(points[i]);
+    kept_points.push_back(i);
+  }
+
+  out_facet_list.clear();
+  size_t num_alive = 0;
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    if (!triangles[t].alive)
+      continue;
+    ++num_alive;
+    out_facet_list.push_back(3);
+    for (int j = 0; j < 3; ++j)
+      out_facet_list.push_back(new_index[triangles[t].v[j]]);
+  }
+  for (size_t i = 0; i < others.size(); i += others[i] + 1) {
+    out_facet_list.push_back(others[i]);
+    for (int j = 1; j <= others[i]; ++j)
+      out_facet_list.push_back(new_index[others[i + j]]);
+  }
+
+  pointList = 0;
+  return num_triangles - num_alive;
+}
+
+CubitVector FacetDecimator::normal(int a, int b, int c) const
+{
+  const std::vector<CubitVector>& p = *pointList;
+  return (p[b] - p[a]) * (p[c] - p[a]);
+}
+
+bool FacetDecimator::has_edge(int a, int b) const
+{
+  const std::vector<int>& tris = incident[a];
+  for (size_t i = 0; i < tris.size(); ++i) {
+    const Triangle& tri = triangles[tris[i]];
+    if (tri.alive && !removing[tris[i]] && (tri.v[0] == b || tri.v[1] == b || tri.v[2] == b))
+      return true;
+  }
+  return false;
+}
+
+bool FacetDecimator::has_triangle(int a, int b, int c) const
+{
+  const std::vector<int>& tris = incident[a];
+  for (size_t i = 0; i < tris.size(); ++i) {
+    const Triangle& tri = triangles[tris[i]];
+    if (!tri.alive || removing[tris[i]])
+      continue;
+    bool has_b = tri.v[0] == b || tri.v[1] == b || tri.v[2] == b;
+    bool has_c = tri.v[0] == c || tri.v[1] == c || tri.v[2] == c;
+    if (has_b && has_c)
+      return true;
+  }
+  return false;
+}
+
+bool FacetDecimator::remove_vertex(int v)
+{
+  const std::vector<CubitVector>& p = *pointList;
+  const std::vector<int>& tris = incident[v];
+  const size_t n = tris.size();
+
+  // Order the opposite edges of the triangles around v into a closed ring;
+  // triangle (v, a, b) contributes the edge a -> b
+  std::vector<std::pair<int, int> > ring_edges(n);
+  for (size_t i = 0; i < n; ++i) {
+    const Triangle& tri = triangles[tris[i]];
+    int k = tri.v[0] == v ? 0 : tri.v[1] == v ? 1 : 2;
+    ring_edges[i] = std::make_pair(tri.v[(k + 1) % 3], tri.v[(k + 2) % 3]);
+  }
+  std::vector<int> ring(1, ring_edges[0].first);
+  std::vector<bool> used(n, false);
+  for (size_t step = 0; step < n; ++step) {
+    size_t next = n;
+    for (size_t i = 0; i < n; ++i) {
+      if (!used[i] && ring_edges[i].first == ring.back()) {
+        next = i;
+        break;
+      }
+    }
+    if (next == n)
+      return false;
+    used[next] = true;
+    ring.push_back(ring_edges[next].second);
+  }
+  if (ring.back() != ring.front())
+    return false;
+  ring.pop_back();
+  std::vector<int> sorted_ring(ring);
+  std::sort(sorted_ring.begin(), sorted_ring.end());
+  if (std::unique(sorted_ring.begin(), sorted_ring.end()) != sorted_ring.end())
+    return false;
+
+  // All triangles must lie in the plane through v with their mean normal
+  CubitVector mean(0, 0, 0);
+  for (size_t i = 0; i < n; ++i)
+    mean += normal(v, ring_edges[i].first, ring_edges[i].second);
+  double length = mean.length();
+  if (length <= 0)
+    return false;
+  mean = mean / length;
+  for (size_t i = 0; i < n; ++i) {
+    CubitVector tri_normal = normal(v, ring_edges[i].first, ring_edges[i].second);
+    double tri_length = tri_normal.length();
+    if (tri_length <= 0 || (tri_normal % mean) < minCos * tri_length)
+      return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (std::fabs((p[ring[i]] - p[v]) % mean) > maxDistance)
+      return false;
+  }
+
+  // Project the ring onto the plane, where it runs counterclockwise
+  CubitVector u = std::fabs(mean.x()) < 0.9 ? CubitVector(1, 0, 0) : CubitVector(0, 1, 0);
+  u = mean * u;
+  u = u / u.length();
+  CubitVector w = mean * u;
+  std::vector<double> uv(2 * n);
+  for (size_t i = 0; i < n; ++i) {
+    CubitVector d = p[ring[i]] - p[v];
+    uv[2*i] = d % u;
+    uv[2*i + 1] = d % w;
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    removing[tris[i]] = 1;
+
+  // Fill the ring by ear clipping; each ear must be convex, empty, not
+  // duplicate an existing edge or triangle and stay within the angle limit
+  std::vector<int> poly(n);
+  for (size_t i = 0; i < n; ++i)
+    poly[i] = i;
+  std::vector<Triangle> fill;
+  bool ok = true;
+  while (ok && poly.size() >= 3) {
+    const size_t m = poly.size();
+    ok = false;
+    for (size_t i = 0; i < m && !ok; ++i) {
+      int a = poly[(i + m - 1) % m], b = poly[i], c = poly[(i + 1) % m];
+      const double *pa = &uv[2*a], *pb = &uv[2*b], *pc = &uv[2*c];
+      if (cross2d(pa, pb, pc) <= 0)
+        continue;
+      bool empty = true;
+      for (size_t j = 0; j < m && empty; ++j) {
+        int q = poly[j];
+        if (q != a && q != b && q != c && in_triangle(&uv[2*q], pa, pb, pc))
+          empty = false;
+      }
+      if (!empty)
+        continue;
+      if (m > 3 && has_edge(ring[a], ring[c]))
+        continue;
+      if (has_triangle(ring[a], ring[b], ring[c]))
+        continue;
+      CubitVector tri_normal = normal(ring[a], ring[b], ring[c]);
+      if ((tri_normal % mean) < minCos * tri_normal.length())
+        continue;
+      Triangle tri = {{ring[a], ring[b], ring[c]}, true};
+      fill.push_back(tri);
+      poly.erase(poly.begin() + i);
+      ok = true;
+    }
+    if (poly.size() < 3)
+      break;
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    removing[tris[i]] = 0;
+  if (!ok || fill.size() != n - 2)
+    return false;
+
+  // Replace the triangles around v by the fill
+  std::vector<int> old_tris(tris);
+  for (size_t i = 0; i < n; ++i)
+    triangles[old_tris[i]].alive = false;
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<int>& ring_tris = incident[ring[i]];
+    size_t kept = 0;
+    for (size_t j = 0; j < ring_tris.size(); ++j) {
+      if (triangles[ring_tris[j]].alive)
+        ring_tris[kept++] = ring_tris[j];
+    }
+    ring_tris.resize(kept);
+  }
+  for (size_t i = 0; i < fill.size(); ++i) {
+    for (int j = 0; j < 3; ++j)
+      incident[fill[i].v[j]].push_back(triangles.size());
+    triangles.push_back(fill[i]);
+    removing.push_back(0);
+  }
+  incident[v].clear();
+
+  return true;
+}
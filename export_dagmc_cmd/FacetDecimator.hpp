@@ -0,0 +1,61 @@
+#ifndef FACETDECIMATOR_HPP
+#define FACETDECIMATOR_HPP
+
+#include <vector>
+
+#include "CubitVector.hpp"
+
+/*!
+ * \brief The FacetDecimator class removes interior vertices of a surface
+ * tessellation where all triangles around them are coplanar, and fills the
+ * hole left by each with fewer triangles.
+ *
+ * Vertices on the tessellation boundary, vertices of non-triangle facets and
+ * vertices marked as fixed are never removed, so the surface keeps the
+ * points it shares with its curves.
+ */
+class FacetDecimator
+{
+public:
+  //! Triangles around a vertex are coplanar when their normals are within
+  //! max_angle degrees of the mean normal and their vertices within
+  //! max_distance of the plane through the vertex
+  FacetDecimator(double max_angle, double max_distance);
+
+  /*!
+   * Decimate a tessellation given as a GMem style facet list, i.e. a vertex
+   * count followed by that many point indices for each facet. fixed holds a
+   * flag for each point. The result has the points that are still used, in
+   * their original order, with kept_points giving the original index of
+   * each. Returns the number of triangles removed.
+   */
+  size_t decimate(const std::vector<CubitVector>& points,
+                  const std::vector<int>& facet_list,
+                  const std::vector<bool>& fixed,
+                  std::vector<CubitVector>& out_points,
+                  std::vector<int>& out_facet_list,
+                  std::vector<int>& kept_points);
+
+private:
+  struct Triangle
+  {
+    int v[3];
+    bool alive;
+  };
+
+  bool remove_vertex(int v);
+  bool has_edge(int a, int b) const;
+  bool has_triangle(int a, int b, int c) const;
+  CubitVector normal(int a, int b, int c) const;
+
+  double minCos;
+  double maxDistance;
+
+  // State of the current decimation
+  const std::vector<CubitVector>* pointList;
+  std::vector<Triangle> triangles;
+  std::vector<std::vector<int> > incident;
+  std::vector<char> removing;
+};
+
+#endif // FACETDECIMATOR_HPP
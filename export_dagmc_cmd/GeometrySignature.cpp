@@ -0,0 +1,134 @@
+#include "GeometrySignature.hpp"
+
+#include <cstring>
+
+// CGM includes
+#include "CubitBox.hpp"
+#include "RefFace.hpp"
+#include "RefEdge.hpp"
+#include "RefVertex.hpp"
+#include "Surface.hpp"
+#include "Curve.hpp"
+
+namespace {
+
+// 64-bit FNV-1a
+const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+unsigned long long fnv1a(unsigned long long h, const void* bytes, size_t size)
+{
+  const unsigned char* p = static_cast<const unsigned char*>(bytes);
+  for (size_t i = 0; i < size; ++i) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+}
+
+GeometrySignature::GeometrySignature() :
+  measure(0.0), topology(FNV_OFFSET)
+{
+  for (int i = 0; i < 6; ++i)
+    box[i] = 0.0;
+}
+
+GeometrySignature GeometrySignature::of_surface(RefFace* face)
+{
+  GeometrySignature sig;
+
+  CubitBox bbox = face->bounding_box();
+  CubitVector min = bbox.minimum(), max = bbox.maximum();
+  double coords[6] = {min.x(), min.y(), min.z(), max.x(), max.y(), max.z()};
+  std::memcpy(sig.box, coords, sizeof(coords));
+  sig.measure = face->measure();
+
+  int sense = face->get_surface_ptr()->bridge_sense();
+  sig.add_to_topology(&sense, sizeof(sense));
+
+  DLIList<RefVertex*> verts;
+  face->ref_vertices(verts);
+  verts.reset();
+  for (int i = verts.size(); i--; )
+    sig.add_to_topology(verts.get_and_step()->coordinates());
+
+  DLIList<RefEdge*> edges;
+  face->ref_edges(edges);
+  edges.reset();
+  int num_edges = edges.size();
+  sig.add_to_topology(&num_edges, sizeof(num_edges));
+  for (int i = edges.size(); i--; ) {
+    double length = edges.get_and_step()->measure();
+    sig.add_to_topology(&length, sizeof(length));
+  }
+
+  return sig;
+}
+
+GeometrySignature GeometrySignature::of_curve(RefEdge* edge)
+{
+  GeometrySignature sig;
+
+  CubitBox bbox = edge->bounding_box();
+  CubitVector min = bbox.minimum(), max = bbox.maximum();
+  double coords[6] = {min.x(), min.y(), min.z(), max.x(), max.y(), max.z()};
+  std::memcpy(sig.box, coords, sizeof(coords));
+  sig.measure = edge->measure();
+
+  int sense = edge->get_curve_ptr()->bridge_sense();
+  sig.add_to_topology(&sense, sizeof(sense));
+  sig.add_to_topology(edge->start_vertex()->coordinates());
+  sig.add_to_topology(edge->end_vertex()->coordinates());
+
+  return sig;
+}
+
+bool GeometrySignature::operator==(const GeometrySignature& other) const
+{
+  for (int i = 0; i < 6; ++i) {
+    if (box[i] != other.box[i])
+      return false;
+  }
+  return measure == other.measure && topology == other.topology;
+}
+
+unsigned long long GeometrySignature::hash() const
+{
+  unsigned long long h = fnv1a(FNV_OFFSET, box, sizeof(box));
+  h = fnv1a(h, &measure, sizeof(measure));
+  return fnv1a(h, &topology, sizeof(topology));
+}
+
+void GeometrySignature::write(std::ostream& out) const
+{
+  out.write(reinterpret_cast<const char*>(box), sizeof(box));
+  out.write(reinterpret_cast<const char*>(&measure), sizeof(measure));
+  out.write(reinterpret_cast<const char*>(&topology), sizeof(topology));
+}
+
+bool GeometrySignature::read(std::istream& in)
+{
+  in.read(reinterpret_cast<char*>(box), sizeof(box));
+  in.read(reinterpret_cast<char*>(&measure), sizeof(measure));
+  in.read(reinterpret_cast<char*>(&topology), sizeof(topology));
+  return bool(in);
+}
+
+void GeometrySignature::add_tolerance(double faceting_tol, int norm_tol)
+{
+  add_to_topology(&faceting_tol, sizeof(faceting_tol));
+  add_to_topology(&norm_tol, sizeof(norm_tol));
+}
+
+void GeometrySignature::add_to_topology(const void* bytes, size_t size)
+{
+  topology = fnv1a(topology, bytes, size);
+}
+
+void GeometrySignature::add_to_topology(const CubitVector& point)
+{
+  double coords[3] = {point.x(), point.y(), point.z()};
+  add_to_topology(coords, sizeof(coords));
+}
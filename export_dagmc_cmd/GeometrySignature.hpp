@@ -0,0 +1,61 @@
+#ifndef GEOMETRYSIGNATURE_HPP
+#define GEOMETRYSIGNATURE_HPP
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "CubitVector.hpp"
+
+class RefFace;
+class RefEdge;
+
+/*!
+ * \brief The GeometrySignature class summarizes the shape of a surface or
+ * curve: its bounding box, its measure and a hash of its sense and bounding
+ * topology. Two entities with equal signatures are taken to facet the same
+ * way. Entity ids are not part of the signature.
+ */
+class GeometrySignature
+{
+public:
+  GeometrySignature();
+
+  static GeometrySignature of_surface(RefFace* face);
+  static GeometrySignature of_curve(RefEdge* edge);
+
+  bool operator==(const GeometrySignature& other) const;
+  bool operator!=(const GeometrySignature& other) const { return !(*this == other); }
+
+  //! Make the signature depend on the tolerances the entity is faceted
+  //! with, for entities that do not use the export-wide tolerances
+  void add_tolerance(double faceting_tol, int norm_tol);
+
+  //! Hash of the whole signature
+  unsigned long long hash() const;
+
+  //! Binary (de)serialization, used by the on-disk facet cache
+  void write(std::ostream& out) const;
+  bool read(std::istream& in);
+
+private:
+  void add_to_topology(const void* bytes, size_t size);
+  void add_to_topology(const CubitVector& point);
+
+  double box[6];
+  double measure;
+  unsigned long long topology;
+};
+
+/*!
+ * \brief Tessellation of a surface or curve kept from an earlier export,
+ * together with the signature of the geometry it was made from.
+ */
+struct CachedFacets
+{
+  GeometrySignature signature;
+  std::vector<CubitVector> points;
+  std::vector<int> facet_list;
+};
+
+#endif // GEOMETRYSIGNATURE_HPP
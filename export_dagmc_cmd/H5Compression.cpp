@@ -0,0 +1,283 @@
+#include "H5Compression.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <hdf5.h>
+
+namespace {
+
+// Target size of a compressed chunk and of the blocks copied at a time
+const hsize_t CHUNK_BYTES = 1 << 16;
+const hsize_t COPY_BYTES = 1 << 22;
+
+struct CopyContext
+{
+  hid_t dst;
+  int level;
+  std::ostream* errors;
+};
+
+// Types holding pointers or references into the source file cannot be
+// copied through a plain buffer
+bool is_plain_type(hid_t type)
+{
+  return H5Tdetect_class(type, H5T_VLEN) == 0 &&
+         H5Tdetect_class(type, H5T_REFERENCE) == 0 &&
+         H5Tis_variable_str(type) == 0;
+}
+
+// The type to create the copy of an object of file_type with in the file of
+// dst_loc. A named datatype is the one at the same path there, which is
+// copied over first if the copy has not reached it yet, so that the copies
+// still share it; any other type is a transient copy.
+hid_t destination_type(hid_t file_type, hid_t dst_loc)
+{
+  if (H5Tcommitted(file_type) <= 0)
+    return H5Tcopy(file_type);
+
+  const ssize_t length = H5Iget_name(file_type, 0, 0);
+  if (length <= 0)
+    return -1;
+  std::vector<char> path(length + 1, '\0');
+  H5Iget_name(file_type, &path[0], path.size());
+
+  hid_t dst_file = H5Iget_file_id(dst_loc);
+  hid_t type = H5Topen2(dst_file, &path[0], H5P_DEFAULT);
+  if (type < 0) {
+    hid_t src_file = H5Iget_file_id(file_type);
+    hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+    if (H5Pset_create_intermediate_group(lcpl, 1) >= 0 &&
+        H5Ocopy(src_file, &path[0], dst_file, &path[0], H5P_DEFAULT, lcpl) >= 0)
+      type = H5Topen2(dst_file, &path[0], H5P_DEFAULT);
+    H5Pclose(lcpl);
+    H5Fclose(src_file);
+  }
+  H5Fclose(dst_file);
+  return type;
+}
+
+herr_t copy_attribute(hid_t loc, const char* name, const H5A_info_t*, void* op_data)
+{
+  CopyContext& ctx = *static_cast<CopyContext*>(op_data);
+  herr_t result = -1;
+
+  hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+  hid_t file_type = H5Aget_type(attr);
+  hid_t type = destination_type(file_type, ctx.dst);
+  hid_t space = H5Aget_space(attr);
+  if (attr >= 0 && type >= 0 && space >= 0 && is_plain_type(type)) {
+    std::vector<char> buffer(std::max<size_t>(1, H5Tget_size(type) * H5Sget_simple_extent_npoints(space)));
+    hid_t copy = H5Acreate2(ctx.dst, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    if (copy >= 0 && H5Aread(attr, type, &buffer[0]) >= 0 &&
+        H5Awrite(copy, type, &buffer[0]) >= 0)
+      result = 0;
+    if (copy >= 0)
+      H5Aclose(copy);
+  }
+  if (result < 0)
+    *ctx.errors << "could not copy attribute " << name << std::endl;
+
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Tclose(file_type);
+  H5Aclose(attr);
+  return result;
+}
+
+bool copy_attributes(hid_t src, hid_t dst, std::ostream& errors)
+{
+  CopyContext ctx = {dst, 0, &errors};
+  hsize_t index = 0;
+  return H5Aiterate2(src, H5_INDEX_NAME, H5_ITER_INC, &index, copy_attribute, &ctx) >= 0;
+}
+
+// Copy the dataset name from src_loc to dst_loc, chunked and compressed.
+// Empty and scalar datasets and those that cannot be copied through a buffer
+// are copied unchanged.
+bool copy_dataset(hid_t src_loc, const char* name, hid_t dst_loc, int level, std::ostream& errors)
+{
+  bool ok = false;
+  hid_t src = H5Dopen2(src_loc, name, H5P_DEFAULT);
+  hid_t file_type = H5Dget_type(src);
+  hid_t type = destination_type(file_type, dst_loc);
+  hid_t space = H5Dget_space(src);
+  hid_t dcpl = H5Dget_create_plist(src);
+  if (src < 0 || type < 0 || space < 0 || dcpl < 0) {
+    errors << "could not open dataset " << name << std::endl;
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    H5Tclose(type);
+    H5Tclose(file_type);
+    H5Dclose(src);
+    return false;
+  }
+
+  const int rank = H5Sget_simple_extent_ndims(space);
+  const hssize_t num_points = H5Sget_simple_extent_npoints(space);
+  if (rank < 1 || num_points <= 0 || !is_plain_type(type) || H5Pget_external_count(dcpl) > 0) {
+    // The named datatype copied above is used again rather than copied
+    // along with the dataset. HDF5 does not merge variable-length types,
+    // which then get a copy of their own.
+    hid_t ocpypl = H5Pcreate(H5P_OBJECT_COPY);
+    ok = ocpypl >= 0 && H5Pset_copy_object(ocpypl, H5O_COPY_MERGE_COMMITTED_DTYPE_FLAG) >= 0 &&
+         H5Ocopy(src_loc, name, dst_loc, name, ocpypl, H5P_DEFAULT) >= 0;
+    H5Pclose(ocpypl);
+    if (!ok)
+      errors << "could not copy dataset " << name << std::endl;
+  }
+  else {
+    std::vector<hsize_t> dims(rank), chunk(rank), offset(rank, 0), count(rank);
+    H5Sget_simple_extent_dims(space, &dims[0], 0);
+
+    // Chunks and copy blocks are whole rows of the leading dimension
+    hsize_t row_bytes = H5Tget_size(type);
+    for (int i = 1; i < rank; ++i)
+      row_bytes *= dims[i];
+    chunk = dims;
+    chunk[0] = std::max<hsize_t>(1, std::min(dims[0], CHUNK_BYTES / std::max<hsize_t>(1, row_bytes)));
+    const hsize_t block_rows = std::max<hsize_t>(chunk[0], COPY_BYTES / std::max<hsize_t>(1, row_bytes));
+
+    // Keep the fill value and other creation properties of the original
+    H5Premove_filter(dcpl, H5Z_FILTER_ALL);
+    hid_t dst = -1;
+    if (H5Pset_chunk(dcpl, rank, &chunk[0]) >= 0 && H5Pset_shuffle(dcpl) >= 0 &&
+        H5Pset_deflate(dcpl, level) >= 0)
+      dst = H5Dcreate2(dst_loc, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+    ok = dst >= 0;
+    std::vector<char> buffer;
+    for (hsize_t start = 0; ok && start < dims[0]; start += block_rows) {
+      count = dims;
+      count[0] = std::min(block_rows, dims[0] - start);
+      offset[0] = start;
+      buffer.resize(count[0] * row_bytes);
+      hid_t file_space = H5Scopy(space);
+      hid_t mem_space = H5Screate_simple(rank, &count[0], 0);
+      ok = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &offset[0], 0, &count[0], 0) >= 0 &&
+           H5Dread(src, type, mem_space, file_space, H5P_DEFAULT, &buffer[0]) >= 0 &&
+           H5Dwrite(dst, type, mem_space, file_space, H5P_DEFAULT, &buffer[0]) >= 0;
+      H5Sclose(mem_space);
+      H5Sclose(file_space);
+    }
+    if (ok)
+      ok = copy_attributes(src, dst, errors);
+    else
+      errors << "could not compress dataset " << name << std::endl;
+    if (dst >= 0)
+      H5Dclose(dst);
+  }
+
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Tclose(file_type);
+  H5Dclose(src);
+  return ok;
+}
+
+herr_t copy_link(hid_t group, const char* name, const H5L_info_t* info, void* op_data)
+{
+  CopyContext& ctx = *static_cast<CopyContext*>(op_data);
+
+  if (info->type == H5L_TYPE_SOFT) {
+    std::vector<char> target(info->u.val_size + 1, '\0');
+    if (H5Lget_val(group, name, &target[0], target.size(), H5P_DEFAULT) < 0 ||
+        H5Lcreate_soft(&target[0], ctx.dst, name, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+      *ctx.errors << "could not copy link " << name << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+  if (info->type != H5L_TYPE_HARD) {
+    *ctx.errors << "cannot copy external link " << name << std::endl;
+    return -1;
+  }
+
+  hid_t obj = H5Oopen(group, name, H5P_DEFAULT);
+  if (obj < 0) {
+    *ctx.errors << "could not open " << name << std::endl;
+    return -1;
+  }
+  H5I_type_t obj_type = H5Iget_type(obj);
+  H5Oclose(obj);
+
+  // A group or named datatype may already have been made for a named
+  // datatype used by an object copied before it
+  const bool exists = H5Lexists(ctx.dst, name, H5P_DEFAULT) > 0;
+
+  bool ok;
+  if (H5I_GROUP == obj_type) {
+    hid_t src = H5Gopen2(group, name, H5P_DEFAULT);
+    hid_t dst = exists ? H5Gopen2(ctx.dst, name, H5P_DEFAULT)
+                       : H5Gcreate2(ctx.dst, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    CopyContext child = {dst, ctx.level, ctx.errors};
+    hsize_t index = 0;
+    ok = src >= 0 && dst >= 0 && copy_attributes(src, dst, *ctx.errors) &&
+         H5Literate(src, H5_INDEX_NAME, H5_ITER_INC, &index, copy_link, &child) >= 0;
+    H5Gclose(dst);
+    H5Gclose(src);
+  }
+  else if (H5I_DATASET == obj_type) {
+    ok = copy_dataset(group, name, ctx.dst, ctx.level, *ctx.errors);
+  }
+  else {
+    // Named datatypes keep their identity so that MOAB can still find them
+    ok = exists || H5Ocopy(group, name, ctx.dst, name, H5P_DEFAULT, H5P_DEFAULT) >= 0;
+    if (!ok)
+      *ctx.errors << "could not copy " << name << std::endl;
+  }
+
+  return ok ? 0 : -1;
+}
+
+}
+
+bool compress_h5_file(const std::string& filename, int level, std::ostream& errors)
+{
+  level = std::max(1, std::min(level, 9));
+  const std::string tmp_name = filename + ".tmp";
+
+  // Failures are reported through errors rather than the HDF5 error stack
+  H5E_auto2_t old_func;
+  void* old_data;
+  H5Eget_auto2(H5E_DEFAULT, &old_func, &old_data);
+  H5Eset_auto2(H5E_DEFAULT, 0, 0);
+
+  bool ok = false;
+  hid_t src = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  hid_t dst = H5Fcreate(tmp_name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (src < 0 || dst < 0) {
+    errors << "could not open " << (src < 0 ? filename : tmp_name) << std::endl;
+  }
+  else {
+    hid_t src_root = H5Gopen2(src, "/", H5P_DEFAULT);
+    hid_t dst_root = H5Gopen2(dst, "/", H5P_DEFAULT);
+    CopyContext ctx = {dst_root, level, &errors};
+    hsize_t index = 0;
+    ok = copy_attributes(src_root, dst_root, errors) &&
+         H5Literate(src_root, H5_INDEX_NAME, H5_ITER_INC, &index, copy_link, &ctx) >= 0;
+    H5Gclose(dst_root);
+    H5Gclose(src_root);
+  }
+  if (dst >= 0 && H5Fclose(dst) < 0)
+    ok = false;
+  if (src >= 0)
+    H5Fclose(src);
+
+  H5Eset_auto2(H5E_DEFAULT, old_func, old_data);
+
+  if (ok) {
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    ok = std::rename(tmp_name.c_str(), filename.c_str()) == 0;
+    if (!ok)
+      errors << "could not replace " << filename << std::endl;
+  }
+  if (!ok)
+    std::remove(tmp_name.c_str());
+
+  return ok;
+}
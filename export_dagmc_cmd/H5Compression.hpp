@@ -0,0 +1,18 @@
+#ifndef H5COMPRESSION_HPP
+#define H5COMPRESSION_HPP
+
+#include <ostream>
+#include <string>
+
+/*!
+ * \brief Rewrite the HDF5 file filename with every dataset chunked and
+ * compressed with deflate at the given level (1-9).
+ *
+ * Groups, named datatypes and attributes are copied unchanged, so the result
+ * can be read by anything that reads the original. The file is rewritten to
+ * a temporary file which then replaces it; on failure the original is left
+ * in place, a reason is written to errors and false is returned.
+ */
+bool compress_h5_file(const std::string& filename, int level, std::ostream& errors);
+
+#endif // H5COMPRESSION_HPP
@@ -0,0 +1,42 @@
+#include "Histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+Histogram::Histogram() :
+  numValues(0), numNonPositive(0), minValue(0), maxValue(0), sum(0)
+{}
+
+void Histogram::add(double value)
+{
+  minValue = numValues ? std::min(minValue, value) : value;
+  maxValue = numValues ? std::max(maxValue, value) : value;
+  sum += value;
+  ++numValues;
+
+  if (value <= 0) {
+    ++numNonPositive;
+    return;
+  }
+  // value = m * 2^e with m in [0.5, 1)
+  int e;
+  std::frexp(value, &e);
+  ++bins[e - 1];
+}
+
+void Histogram::print(std::ostream& out, const std::string& title) const
+{
+  out << title << ": " << numValues << " values";
+  if (0 == numValues) {
+    out << std::endl;
+    return;
+  }
+  out << ", min " << minValue << ", mean " << sum / numValues
+      << ", max " << maxValue << std::endl;
+
+  if (numNonPositive > 0)
+    out << "  <= 0: " << numNonPositive << std::endl;
+  for (std::map<int, size_t>::const_iterator bi = bins.begin(); bi != bins.end(); ++bi)
+    out << "  [" << std::ldexp(1.0, bi->first) << ", " << std::ldexp(1.0, bi->first + 1)
+        << "): " << bi->second << std::endl;
+}
@@ -0,0 +1,35 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+
+/*!
+ * \brief The Histogram class counts positive values in bins of powers of
+ * two, so counts and lengths spanning several orders of magnitude fit in a
+ * few lines. Zero and negative values are counted separately.
+ */
+class Histogram
+{
+public:
+  Histogram();
+
+  void add(double value);
+
+  size_t count() const { return numValues; }
+
+  //! Print the number of values, their minimum, mean and maximum and one
+  //! line for each non-empty bin
+  void print(std::ostream& out, const std::string& title) const;
+
+private:
+  //! Number of values in [2^k, 2^(k+1)) for each k
+  std::map<int, size_t> bins;
+  size_t numValues;
+  size_t numNonPositive;
+  double minValue, maxValue, sum;
+};
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,65 @@
+#include "MortonOrder.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+typedef unsigned long long MortonCode;
+
+// Bits per axis of a code
+const int MORTON_BITS = 21;
+
+// Spread the low MORTON_BITS bits of x so that there are two zero bits
+// between each of them
+MortonCode spread_bits(MortonCode x)
+{
+  x &= 0x1fffffULL;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2) & 0x1249249249249249ULL;
+  return x;
+}
+
+MortonCode cell(double x, double min, double scale)
+{
+  const double max_cell = (double)((1ULL << MORTON_BITS) - 1);
+  return (MortonCode)std::min(max_cell, std::max(0.0, (x - min) * scale));
+}
+
+}
+
+void morton_order(const std::vector<CubitVector>& points, std::vector<int>& order)
+{
+  order.resize(points.size());
+  if (points.empty())
+    return;
+
+  double min[3] = {points[0].x(), points[0].y(), points[0].z()};
+  double max[3] = {min[0], min[1], min[2]};
+  for (size_t i = 1; i < points.size(); ++i) {
+    const double p[3] = {points[i].x(), points[i].y(), points[i].z()};
+    for (int d = 0; d < 3; ++d) {
+      min[d] = std::min(min[d], p[d]);
+      max[d] = std::max(max[d], p[d]);
+    }
+  }
+
+  // The same scale on every axis keeps the cells cubic
+  double extent = std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2]));
+  double scale = extent > 0 ? ((1ULL << MORTON_BITS) - 1) / extent : 0.0;
+
+  std::vector<std::pair<MortonCode, int> > codes(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    codes[i].first = spread_bits(cell(points[i].x(), min[0], scale)) |
+                     spread_bits(cell(points[i].y(), min[1], scale)) << 1 |
+                     spread_bits(cell(points[i].z(), min[2], scale)) << 2;
+    codes[i].second = i;
+  }
+  std::sort(codes.begin(), codes.end());
+
+  for (size_t i = 0; i < codes.size(); ++i)
+    order[i] = codes[i].second;
+}
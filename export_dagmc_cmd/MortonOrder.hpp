@@ -0,0 +1,16 @@
+#ifndef MORTONORDER_HPP
+#define MORTONORDER_HPP
+
+#include <vector>
+
+#include "CubitVector.hpp"
+
+/*!
+ * \brief Fill order with the indices of points sorted along a Morton
+ * (Z-order) curve through their bounding box, so that points close in the
+ * order are close in space. Points with the same Morton code keep their
+ * relative order, so the result only depends on the points.
+ */
+void morton_order(const std::vector<CubitVector>& points, std::vector<int>& order);
+
+#endif // MORTONORDER_HPP
@@ -0,0 +1,66 @@
+#include "PointGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+PointGrid::PointGrid(double tolerance) :
+  tol(tolerance), pointList(0), numComparisons(0)
+{}
+
+long long PointGrid::cell_coord(double x) const
+{
+  return (long long)std::floor(x / tol);
+}
+
+PointGrid::CellKey PointGrid::cell_key(long long i, long long j, long long k) const
+{
+  // Distinct cells may share a key; that only adds candidates, since every
+  // candidate is checked against the actual distance
+  return ((CellKey)i * 73856093ULL) ^ ((CellKey)j * 19349663ULL) ^ ((CellKey)k * 83492791ULL);
+}
+
+void PointGrid::build(const std::vector<CubitVector>& points)
+{
+  pointList = &points;
+  cells.resize(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    const CubitVector& p = points[i];
+    cells[i].first = cell_key(cell_coord(p.x()), cell_coord(p.y()), cell_coord(p.z()));
+    cells[i].second = i;
+  }
+  std::sort(cells.begin(), cells.end());
+}
+
+int PointGrid::find(const CubitVector& pos) const
+{
+  if (!pointList)
+    return -1;
+
+  const long long ci = cell_coord(pos.x());
+  const long long cj = cell_coord(pos.y());
+  const long long ck = cell_coord(pos.z());
+
+  int found = -1;
+  for (long long i = ci - 1; i <= ci + 1; ++i) {
+    for (long long j = cj - 1; j <= cj + 1; ++j) {
+      for (long long k = ck - 1; k <= ck + 1; ++k) {
+        std::pair<CellKey, int> first(cell_key(i, j, k), -1);
+        std::vector<std::pair<CellKey, int> >::const_iterator it =
+          std::lower_bound(cells.begin(), cells.end(), first);
+        // Points in a cell are sorted by index, so the first hit is the
+        // lowest index within that cell
+        for (; it != cells.end() && it->first == first.first; ++it) {
+          if (found >= 0 && it->second >= found)
+            break;
+          ++numComparisons;
+          if ((pos - (*pointList)[it->second]).length_squared() < tol*tol) {
+            found = it->second;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  return found;
+}
@@ -0,0 +1,45 @@
+#ifndef POINTGRID_HPP
+#define POINTGRID_HPP
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+#include "CubitVector.hpp"
+
+/*!
+ * \brief The PointGrid class is a uniform-grid spatial index over a list of
+ * points. Cells are the size of the coincidence tolerance, so a coincident
+ * point can only lie in the cell of the query position or one of its 26
+ * neighbours.
+ */
+class PointGrid
+{
+public:
+  PointGrid(double tolerance);
+
+  //! Index the given points, replacing any previously indexed ones. The
+  //! points must stay alive while the grid is queried.
+  void build(const std::vector<CubitVector>& points);
+
+  //! Returns the lowest index of an indexed point closer than the tolerance
+  //! to pos, or -1 if there is none.
+  int find(const CubitVector& pos) const;
+
+  //! Number of point-to-point distance checks made by find() so far
+  size_t comparisons() const { return numComparisons; }
+
+private:
+  typedef unsigned long long CellKey;
+
+  long long cell_coord(double x) const;
+  CellKey cell_key(long long i, long long j, long long k) const;
+
+  double tol;
+  const std::vector<CubitVector>* pointList;
+  //! (cell key, point index) pairs sorted by key, then by index
+  std::vector<std::pair<CellKey, int> > cells;
+  mutable size_t numComparisons;
+};
+
+#endif // POINTGRID_HPP
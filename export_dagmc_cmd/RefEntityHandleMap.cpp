@@ -0,0 +1,41 @@
+#include "RefEntityHandleMap.hpp"
+
+#include "RefEntity.hpp"
+
+bool RefEntityHandleMap::insert(RefEntity* ent, moab::EntityHandle handle)
+{
+  int id = ent->id();
+  if (id < 0)
+    return false;
+
+  if ((size_t)id >= idIndex.size())
+    idIndex.resize(id + 1, 0);
+  else if (idIndex[id])
+    return false;
+
+  entries.push_back(value_type(ent, handle));
+  idIndex[id] = entries.size();
+  return true;
+}
+
+moab::EntityHandle RefEntityHandleMap::find(RefEntity* ent) const
+{
+  size_t pos = position(ent);
+  return pos < entries.size() ? entries[pos].second : 0;
+}
+
+size_t RefEntityHandleMap::position(RefEntity* ent) const
+{
+  int id = ent->id();
+  if (id < 0 || (size_t)id >= idIndex.size() || !idIndex[id])
+    return entries.size();
+
+  size_t pos = idIndex[id] - 1;
+  return entries[pos].first == ent ? pos : entries.size();
+}
+
+void RefEntityHandleMap::clear()
+{
+  entries.clear();
+  idIndex.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef REFENTITYHANDLEMAP_HPP
+#define REFENTITYHANDLEMAP_HPP
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "moab/Types.hpp"
+
+class RefEntity;
+
+/*!
+ * \brief The RefEntityHandleMap class maps CGM entities of a single kind to
+ * MOAB handles. Entries are stored contiguously in insertion order, which
+ * makes iteration deterministic, and are looked up through a dense table
+ * indexed by RefEntity::id().
+ */
+class RefEntityHandleMap
+{
+public:
+  typedef std::pair<RefEntity*, moab::EntityHandle> value_type;
+  typedef std::vector<value_type>::iterator iterator;
+  typedef std::vector<value_type>::const_iterator const_iterator;
+
+  //! Add an entity to the map. Returns false if an entity with the same id
+  //! is already present.
+  bool insert(RefEntity* ent, moab::EntityHandle handle);
+
+  //! Returns the handle of ent, or 0 if ent is not in the map. MOAB never
+  //! hands out a zero handle, so 0 always means "not found".
+  moab::EntityHandle find(RefEntity* ent) const;
+
+  bool contains(RefEntity* ent) const { return 0 != find(ent); }
+
+  //! Returns the position of ent in the insertion order, or size() if ent is
+  //! not in the map
+  size_t position(RefEntity* ent) const;
+
+  iterator begin() { return entries.begin(); }
+  iterator end() { return entries.end(); }
+  const_iterator begin() const { return entries.begin(); }
+  const_iterator end() const { return entries.end(); }
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+
+  void clear();
+
+private:
+  std::vector<value_type> entries;
+  //! Position in entries plus one for each entity id, 0 if absent
+  std::vector<size_t> idIndex;
+};
+
+#endif // REFENTITYHANDLEMAP_HPP
@@ -0,0 +1,283 @@
+// Batch-mode benchmark for the 'export dagmc' command.
+//
+// Builds a set of parametrically generated models through the Cubit SDK,
+// exports each one with the DAGMC export plugin and reports the throughput
+// in surfaces and triangles per second. The plugin must be installed in the
+// Cubit plugin directory so that it is loaded when Cubit is initialized.
+//
+// usage: dagmc_export_bench [size] [output_dir] [export options...]
+//
+// in_memory, dry_run and several faceting tolerances are rejected, since the
+// triangles are counted from the files written.
+
+#include "CubitInterface.hpp"
+
+// MOAB includes
+#include "moab/Core.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchModel
+{
+  std::string name;
+  std::vector<std::string> commands;
+};
+
+// n x n x n lattice of imprinted and merged unit cubes
+BenchModel cube_lattice(int n)
+{
+  BenchModel model;
+  std::ostringstream name;
+  name << "cube_lattice_" << n;
+  model.name = name.str();
+
+  model.commands.push_back("brick x 1");
+  if (n > 1) {
+    std::ostringstream cmd;
+    cmd << "volume all copy move x 1 repeat " << n - 1;
+    model.commands.push_back(cmd.str());
+    cmd.str("");
+    cmd << "volume all copy move y 1 repeat " << n - 1;
+    model.commands.push_back(cmd.str());
+    cmd.str("");
+    cmd << "volume all copy move z 1 repeat " << n - 1;
+    model.commands.push_back(cmd.str());
+  }
+  model.commands.push_back("imprint volume all");
+  model.commands.push_back("merge volume all");
+  return model;
+}
+
+// Torus cut into many curved pieces, giving a large number of analytic
+// toroidal surfaces
+BenchModel sliced_torus(int n)
+{
+  BenchModel model;
+  std::ostringstream name;
+  name << "sliced_torus_" << n;
+  model.name = name.str();
+
+  model.commands.push_back("torus major radius 10 minor radius 2");
+  for (int i = 0; i < 4 * n; ++i) {
+    std::ostringstream cmd;
+    cmd << "webcut volume all with plane xplane rotate " << (180.0 * i) / (4 * n)
+        << " about z";
+    model.commands.push_back(cmd.str());
+  }
+  model.commands.push_back("imprint volume all");
+  model.commands.push_back("merge volume all");
+  return model;
+}
+
+// Row of cubes collected into a deep hierarchy of nested groups
+BenchModel group_hierarchy(int n)
+{
+  BenchModel model;
+  std::ostringstream name;
+  name << "group_hierarchy_" << n;
+  model.name = name.str();
+
+  const int num_vols = 8 * n;
+  model.commands.push_back("brick x 1");
+  std::ostringstream cmd;
+  cmd << "volume 1 copy move x 2 repeat " << num_vols - 1;
+  model.commands.push_back(cmd.str());
+
+  // One group per volume, then pairs of groups merged level by level
+  std::vector<std::string> level;
+  for (int i = 1; i <= num_vols; ++i) {
+    std::ostringstream grp;
+    grp << "g0_" << i;
+    cmd.str("");
+    cmd << "group '" << grp.str() << "' add volume " << i;
+    model.commands.push_back(cmd.str());
+    level.push_back(grp.str());
+  }
+  for (int depth = 1; level.size() > 1; ++depth) {
+    std::vector<std::string> next;
+    for (size_t i = 0; i < level.size(); i += 2) {
+      std::ostringstream grp;
+      grp << "g" << depth << "_" << i / 2 + 1;
+      cmd.str("");
+      cmd << "group '" << grp.str() << "' add group " << level[i];
+      if (i + 1 < level.size())
+        cmd << " " << level[i + 1];
+      model.commands.push_back(cmd.str());
+      next.push_back(grp.str());
+    }
+    level.swap(next);
+  }
+  return model;
+}
+
+int count_file_triangles(const std::string& filename)
+{
+  moab::Core mbi;
+  if (moab::MB_SUCCESS != mbi.load_file(filename.c_str()))
+    return -1;
+  int num_tris = 0;
+  mbi.get_number_entities_by_type(0, moab::MBTRI, num_tris);
+  return num_tris;
+}
+
+// Triangles written by an export to filename. Batches and shards are
+// counted from the files listed in their index, one file name and its
+// volume ids per line; surfaces shared by batches are counted once per
+// batch file, as they are written.
+int count_triangles(const std::string& filename, const std::string& index_suffix)
+{
+  if (index_suffix.empty())
+    return count_file_triangles(filename);
+
+  std::string::size_type dot = filename.find_last_of('.');
+  std::ifstream index((filename.substr(0, dot) + index_suffix).c_str());
+  if (!index)
+    return -1;
+  int num_tris = 0;
+  std::string line;
+  while (std::getline(index, line)) {
+    std::istringstream fields(line);
+    std::string part;
+    if (!(fields >> part))
+      continue;
+    int part_tris = count_file_triangles(part);
+    if (part_tris < 0)
+      return -1;
+    num_tris += part_tris;
+  }
+  return num_tris;
+}
+
+// Whether the export options contain the keyword option
+bool has_option(const std::vector<std::string>& options, const std::string& option)
+{
+  return std::find(options.begin(), options.end(), option) != options.end();
+}
+
+// The numbers following option in the export options
+std::vector<double> option_values(const std::vector<std::string>& options,
+                                  const std::string& option)
+{
+  std::vector<double> values;
+  std::vector<std::string>::const_iterator it =
+    std::find(options.begin(), options.end(), option);
+  if (it == options.end())
+    return values;
+  for (++it; it != options.end(); ++it) {
+    char* end;
+    double value = std::strtod(it->c_str(), &end);
+    if (end == it->c_str() || *end)
+      break;
+    values.push_back(value);
+  }
+  return values;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  int size = argc > 1 ? std::atoi(argv[1]) : 4;
+  if (size < 1)
+    size = 1;
+  std::string out_dir = argc > 2 ? argv[2] : ".";
+  std::string export_options;
+  std::vector<std::string> options;
+  for (int i = 3; i < argc; ++i) {
+    export_options += std::string(" ") + argv[i];
+    options.push_back(argv[i]);
+  }
+
+  // The triangles are counted from the files written, so options that
+  // write none, or one per faceting tolerance, cannot be benchmarked
+  const char* const unsupported[] = {"in_memory", "dry_run"};
+  for (size_t i = 0; i < sizeof(unsupported) / sizeof(unsupported[0]); ++i) {
+    if (has_option(options, unsupported[i])) {
+      std::cerr << "The benchmark counts the triangles written, which "
+                << unsupported[i] << " does not write" << std::endl;
+      return 1;
+    }
+  }
+  if (option_values(options, "faceting_tolerance").size() > 1) {
+    std::cerr << "The benchmark only supports a single faceting tolerance" << std::endl;
+    return 1;
+  }
+  // A batch or shard index lists the files written instead of the model file
+  std::vector<double> batch_size = option_values(options, "batch_size");
+  std::vector<double> shards = option_values(options, "shards");
+  std::string index_suffix;
+  if (!batch_size.empty() && batch_size[0] > 0)
+    index_suffix = ".batches";
+  else if (!shards.empty() && shards[0] > 1)
+    index_suffix = ".shards";
+
+  std::vector<std::string> cubit_args;
+  cubit_args.push_back("dagmc_export_bench");
+  cubit_args.push_back("-nographics");
+  cubit_args.push_back("-nojournal");
+  cubit_args.push_back("-batch");
+  CubitInterface::init(cubit_args);
+
+  std::vector<BenchModel> models;
+  models.push_back(cube_lattice(size));
+  models.push_back(sliced_torus(size));
+  models.push_back(group_hierarchy(size));
+
+  std::cout << std::left << std::setw(24) << "model" << std::right
+            << std::setw(10) << "surfaces"
+            << std::setw(12) << "triangles"
+            << std::setw(12) << "time (s)"
+            << std::setw(14) << "surfaces/s"
+            << std::setw(14) << "triangles/s" << std::endl;
+
+  int status = 0;
+  for (size_t m = 0; m < models.size(); ++m) {
+    const BenchModel& model = models[m];
+
+    CubitInterface::silent_cmd("reset");
+    bool built = true;
+    for (size_t c = 0; c < model.commands.size(); ++c)
+      built = CubitInterface::silent_cmd(model.commands[c].c_str()) && built;
+    if (!built) {
+      std::cerr << "Failed to build model " << model.name << std::endl;
+      status = 1;
+      continue;
+    }
+    const size_t num_surfs = CubitInterface::get_entities("surface").size();
+
+    std::string filename = out_dir + "/" + model.name + ".h5m";
+    std::string export_cmd = "export dagmc '" + filename + "'" + export_options;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool exported = CubitInterface::silent_cmd(export_cmd.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int num_tris = exported ? count_triangles(filename, index_suffix) : -1;
+    if (num_tris < 0) {
+      std::cerr << "Failed to export model " << model.name << std::endl;
+      status = 1;
+      continue;
+    }
+
+    std::cout << std::left << std::setw(24) << model.name << std::right
+              << std::setw(10) << num_surfs
+              << std::setw(12) << num_tris
+              << std::setw(12) << std::fixed << std::setprecision(3) << seconds
+              << std::setw(14) << std::setprecision(1) << num_surfs / seconds
+              << std::setw(14) << num_tris / seconds << std::endl;
+  }
+
+  // Release the Cubit session and its license before exiting
+  CubitInterface::shutdown();
+  return status;
+}